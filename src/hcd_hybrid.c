@@ -18,6 +18,10 @@
 #include "pico.h"
 #include "hardware/irq.h"
 #include "hardware/resets.h"
+#include "hardware/sync.h"
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+#include "hardware/clocks.h"
 
 // Native USB includes
 #include "rp2040_usb.h"
@@ -30,6 +34,8 @@
 #include "host/hcd.h"
 #include "host/usbh.h"
 
+#include "hcd_hybrid.h"
+
 //--------------------------------------------------------------------+
 // Port Mapping
 //--------------------------------------------------------------------+
@@ -62,6 +68,64 @@ enum {
 static pio_usb_configuration_t pio_host_cfg = PIO_USB_DEFAULT_CONFIG;
 static bool pio_usb_initialized = false;
 
+// Bus suspend state, see hcd_hybrid_suspend()
+static bool bus_suspended = false;
+static bool bus_resuming = false;       // Driving resume signalling
+static uint8_t resume_speed = 0;        // Native port speed resumed, 0 = none
+
+// Completion time of the last IN transfer per device address, taken in
+// the transfer-complete interrupt (see hcd_hybrid_xfer_time())
+#define XFER_TIME_ADDRS 16
+static volatile uint32_t xfer_time_us[XFER_TIME_ADDRS];
+
+static void __tusb_irq_path_func(xfer_time_record)(uint8_t dev_addr, uint8_t ep_addr) {
+    if ((ep_addr & TUSB_DIR_IN_MASK) && dev_addr < XFER_TIME_ADDRS) {
+        xfer_time_us[dev_addr] = time_us_32();
+    }
+}
+static volatile bool bus_wakeup = false;
+
+//--------------------------------------------------------------------+
+// Endpoint Halt Recovery
+//
+// Non-control endpoints that answer with STALL are queued here from IRQ
+// context. hcd_hybrid_task() then issues CLEAR_FEATURE(ENDPOINT_HALT)
+// and resets the host-side data toggle once the device has accepted it.
+//--------------------------------------------------------------------+
+#define HALT_QUEUE_SIZE 8
+#define HALT_RETRIES    3
+
+typedef struct {
+    uint8_t dev_addr;
+    uint8_t ep_addr;
+    uint8_t tries;
+} halt_entry_t;
+
+static halt_entry_t halt_queue[HALT_QUEUE_SIZE];
+static volatile uint8_t halt_head = 0;
+static volatile uint8_t halt_tail = 0;
+static bool halt_in_progress = false;
+
+static void __tusb_irq_path_func(halt_record)(uint8_t dev_addr, uint8_t ep_addr) {
+    // Control endpoint stalls are protocol stalls, usbh handles those
+    if (tu_edpt_number(ep_addr) == 0) return;
+
+    uint32_t save = save_and_disable_interrupts();
+    bool queued = false;
+    for (uint8_t i = halt_tail; i != halt_head; i++) {
+        halt_entry_t const *h = &halt_queue[i % HALT_QUEUE_SIZE];
+        if (h->dev_addr == dev_addr && h->ep_addr == ep_addr) {
+            queued = true;
+            break;
+        }
+    }
+    if (!queued && (uint8_t)(halt_head - halt_tail) < HALT_QUEUE_SIZE) {
+        halt_queue[halt_head % HALT_QUEUE_SIZE] = (halt_entry_t){ dev_addr, ep_addr, 0 };
+        halt_head++;
+    }
+    restore_interrupts(save);
+}
+
 //--------------------------------------------------------------------+
 // Native USB Helper Functions
 //--------------------------------------------------------------------+
@@ -89,6 +153,8 @@ static void __tusb_irq_path_func(hw_xfer_complete)(struct hw_endpoint *ep, xfer_
     uint8_t ep_addr = ep->ep_addr;
     uint xferred_len = ep->xferred_len;
     hw_endpoint_reset_transfer(ep);
+    if (xfer_result == XFER_RESULT_STALLED) halt_record(dev_addr, ep_addr);
+    xfer_time_record(dev_addr, ep_addr);
     hcd_event_xfer_complete(dev_addr, ep_addr, xferred_len, xfer_result, true);
 }
 
@@ -147,7 +213,26 @@ static void __tusb_irq_path_func(hcd_rp2040_irq)(void) {
     if (status & USB_INTS_STALL_BITS) {
         handled |= USB_INTS_STALL_BITS;
         usb_hw_clear->sie_status = USB_SIE_STATUS_STALL_REC_BITS;
-        hw_xfer_complete(&epx, XFER_RESULT_STALLED);
+        if (epx.active) {
+            hw_xfer_complete(&epx, XFER_RESULT_STALLED);
+        } else {
+            // Hardware-polled interrupt endpoint stalled. The SIE status
+            // does not say which one, its buffer control does; only if no
+            // buffer shows it fall back to every active endpoint, since
+            // clearing a halt that is not set only resets the toggle.
+            bool found = false;
+            for (uint i = 1; i < TU_ARRAY_SIZE(ep_pool); i++) {
+                struct hw_endpoint *ep = &ep_pool[i];
+                if (ep->configured && ep->active && (*ep->buffer_control & USB_BUF_CTRL_STALL)) {
+                    halt_record(ep->dev_addr, ep->ep_addr);
+                    found = true;
+                }
+            }
+            for (uint i = 1; !found && i < TU_ARRAY_SIZE(ep_pool); i++) {
+                struct hw_endpoint *ep = &ep_pool[i];
+                if (ep->configured && ep->active) halt_record(ep->dev_addr, ep->ep_addr);
+            }
+        }
     }
 
     if (status & USB_INTS_BUFF_STATUS_BITS) {
@@ -161,6 +246,12 @@ static void __tusb_irq_path_func(hcd_rp2040_irq)(void) {
         hw_trans_complete();
     }
 
+    if (status & USB_INTS_HOST_RESUME_BITS) {
+        handled |= USB_INTS_HOST_RESUME_BITS;
+        usb_hw_clear->sie_status = USB_SIE_STATUS_RESUME_BITS;
+        if (bus_suspended) bus_wakeup = true;
+    }
+
     if (status & USB_INTS_ERROR_RX_TIMEOUT_BITS) {
         handled |= USB_INTS_ERROR_RX_TIMEOUT_BITS;
         usb_hw_clear->sie_status = USB_SIE_STATUS_RX_TIMEOUT_BITS;
@@ -258,6 +349,8 @@ static void __no_inline_not_in_flash_func(handle_endpoint_irq)(root_port_t *rpor
         uint32_t const mask = (1u << ep_idx);
         if (ep_all & mask) {
             endpoint_t *ep = PIO_USB_ENDPOINT(ep_idx);
+            if (result == XFER_RESULT_STALLED) halt_record(ep->dev_addr, ep->ep_num);
+            xfer_time_record(ep->dev_addr, ep->ep_num);
             hcd_event_xfer_complete(ep->dev_addr, ep->ep_num, ep->actual_len, result, true);
         }
     }
@@ -538,10 +631,260 @@ bool hcd_setup_send(uint8_t rhport, uint8_t dev_addr, uint8_t const setup_packet
 }
 
 bool hcd_edpt_clear_stall(uint8_t rhport, uint8_t dev_addr, uint8_t ep_addr) {
-    (void)rhport;
-    (void)dev_addr;
-    (void)ep_addr;
-    return true;
+    if (IS_NATIVE_PORT(rhport)) {
+        struct hw_endpoint *ep = get_dev_ep(dev_addr, ep_addr);
+        TU_VERIFY(ep);
+
+        // A transfer armed before the halt was cleared still carries the old
+        // PID. Fail it so the class driver re-arms it starting from DATA0.
+        bool const was_active = ep->active;
+        if (was_active) {
+            *ep->buffer_control = 0;
+            hw_endpoint_reset_transfer(ep);
+        }
+        ep->next_pid = 0;
+
+        if (was_active) {
+            hcd_event_xfer_complete(dev_addr, ep_addr, 0, XFER_RESULT_FAILED, false);
+        }
+        return true;
+    }
+
+    uint8_t const pio_rhport = RHPORT_PIO(rhport);
+    for (uint8_t ep_idx = 0; ep_idx < PIO_USB_EP_POOL_CNT; ep_idx++) {
+        endpoint_t *ep = PIO_USB_ENDPOINT(ep_idx);
+        if (ep->size && ep->root_idx == pio_rhport && ep->dev_addr == dev_addr && ep->ep_num == ep_addr) {
+            ep->data_id = 0;
+            ep->stalled = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------+
+// Bus Suspend / Resume
+//
+// Stopping SOF lets every attached device (and hubs, which propagate it)
+// enter USB suspend after 3 ms of idle bus. Remote wakeup is seen as the
+// native HOST_RESUME interrupt, or as any edge on the idle PIO-USB lines.
+//
+// Resume follows USB 2.0 7.1.7.7: the host drives K on every root port
+// for at least 20 ms (taking over a device's remote wakeup K), ends it
+// with a low-speed EOP (SE0 for two LS bit times, then J) and restarts
+// SOF / keep-alive within 3 ms. The native port drives the lines through
+// the PHY direct override, the PIO ports through their TX state machine,
+// as pio_usb_host_port_reset_start() does for SE0.
+//--------------------------------------------------------------------+
+
+// Line states for a port's speed, bit 0 DP and bit 1 DM
+#define LINE_K(fs)    ((fs) ? 0b10u : 0b01u)
+#define LINE_SE0      0b00u
+#define LINE_J(fs)    ((fs) ? 0b01u : 0b10u)
+
+// Two low-speed bit times (1.33 us) in system clock cycles
+#define EOP_SE0_CYCLES  (2 * clock_get_hz(clk_sys) / 1500000)
+
+// Native port: drive (DP, DM) from line, both outputs enabled
+static void sie_drive(uint8_t line) {
+    usb_hw->phy_direct = USB_USBPHY_DIRECT_TX_DP_OE_BITS | USB_USBPHY_DIRECT_TX_DM_OE_BITS |
+                         ((line & 1) ? USB_USBPHY_DIRECT_TX_DP_BITS : 0) |
+                         ((line & 2) ? USB_USBPHY_DIRECT_TX_DM_BITS : 0);
+    usb_hw->phy_direct_override = USB_USBPHY_DIRECT_OVERRIDE_TX_DIFFMODE_OVERRIDE_EN_BITS |
+                                  USB_USBPHY_DIRECT_OVERRIDE_TX_DP_OVERRIDE_EN_BITS |
+                                  USB_USBPHY_DIRECT_OVERRIDE_TX_DM_OVERRIDE_EN_BITS |
+                                  USB_USBPHY_DIRECT_OVERRIDE_TX_DP_OE_OVERRIDE_EN_BITS |
+                                  USB_USBPHY_DIRECT_OVERRIDE_TX_DM_OE_OVERRIDE_EN_BITS;
+}
+
+// PIO port: drive (DP, DM) from line through the TX state machine
+static void pio_drive(root_port_t *root, uint8_t line) {
+    pio_port_t *pp = PIO_USB_PIO_PORT(0);
+    uint32_t const mask = (1u << root->pin_dp) | (1u << root->pin_dm);
+    uint32_t const pins = ((line & 1) ? 1u << root->pin_dp : 0) | ((line & 2) ? 1u << root->pin_dm : 0);
+
+    pio_sm_set_pins_with_mask(pp->pio_usb_tx, pp->sm_tx, pins, mask);
+    pio_sm_set_pindirs_with_mask(pp->pio_usb_tx, pp->sm_tx, mask, mask);
+}
+
+static void pio_release(root_port_t *root) {
+    pio_port_t *pp = PIO_USB_PIO_PORT(0);
+    uint32_t const mask = (1u << root->pin_dp) | (1u << root->pin_dm);
+    pio_sm_set_pindirs_with_mask(pp->pio_usb_tx, pp->sm_tx, 0, mask);
+}
+
+static void pio_line_irq(void) {
+    for (uint8_t i = 0; i < PIO_USB_ROOT_PORT_CNT; i++) {
+        root_port_t *root = PIO_USB_ROOT_PORT(i);
+        if (!root->initialized) continue;
+        uint8_t const pins[2] = { root->pin_dp, root->pin_dm };
+        for (uint8_t j = 0; j < 2; j++) {
+            uint32_t const events = gpio_get_irq_event_mask(pins[j]);
+            if (events) {
+                gpio_acknowledge_irq(pins[j], events);
+                bus_wakeup = true;
+            }
+        }
+    }
+}
+
+static void pio_line_irq_enable(bool enable) {
+    for (uint8_t i = 0; i < PIO_USB_ROOT_PORT_CNT; i++) {
+        root_port_t *root = PIO_USB_ROOT_PORT(i);
+        if (!root->initialized) continue;
+        uint32_t const mask = (1u << root->pin_dp) | (1u << root->pin_dm);
+        if (enable) {
+            gpio_add_raw_irq_handler_masked(mask, pio_line_irq);
+        } else {
+            gpio_remove_raw_irq_handler_masked(mask, pio_line_irq);
+        }
+        gpio_set_irq_enabled(root->pin_dp, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, enable);
+        gpio_set_irq_enabled(root->pin_dm, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, enable);
+    }
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+void hcd_hybrid_suspend(void) {
+    if (bus_suspended) return;
+
+    bus_wakeup = false;
+    bus_suspended = true;
+
+    usb_hw->sie_ctrl = SIE_CTRL_BASE & ~(USB_SIE_CTRL_SOF_EN_BITS | USB_SIE_CTRL_KEEP_ALIVE_EN_BITS);
+
+    if (pio_usb_initialized) {
+        pio_usb_host_stop();
+        pio_line_irq_enable(true);
+    }
+}
+
+void hcd_hybrid_resume(void) {
+    if (!bus_suspended || bus_resuming) return;
+
+    // Our own K would read as line activity
+    if (pio_usb_initialized) pio_line_irq_enable(false);
+
+    // Speed as seen at the idle J, read before our K is on the lines
+    resume_speed = dev_speed();
+    if (resume_speed) sie_drive(LINE_K(resume_speed == 2));
+
+    if (pio_usb_initialized) {
+        for (uint8_t i = 0; i < PIO_USB_ROOT_PORT_CNT; i++) {
+            root_port_t *root = PIO_USB_ROOT_PORT(i);
+            if (root->initialized && root->connected) pio_drive(root, LINE_K(root->is_fullspeed));
+        }
+    }
+
+    bus_resuming = true;
+}
+
+void hcd_hybrid_resume_end(void) {
+    if (!bus_resuming) return;
+
+    // The EOP is timed in cycles, nothing may stretch it
+    uint32_t save = save_and_disable_interrupts();
+
+    if (resume_speed) {
+        sie_drive(LINE_SE0);
+        busy_wait_at_least_cycles(EOP_SE0_CYCLES);
+        sie_drive(LINE_J(resume_speed == 2));
+        usb_hw->phy_direct_override = 0;
+    }
+
+    if (pio_usb_initialized) {
+        for (uint8_t i = 0; i < PIO_USB_ROOT_PORT_CNT; i++) {
+            root_port_t *root = PIO_USB_ROOT_PORT(i);
+            if (!root->initialized || !root->connected) continue;
+            pio_drive(root, LINE_SE0);
+            busy_wait_at_least_cycles(EOP_SE0_CYCLES);
+            pio_drive(root, LINE_J(root->is_fullspeed));
+            pio_release(root);
+        }
+    }
+
+    restore_interrupts(save);
+
+    // SOF / keep-alive well within the 3 ms after the EOP
+    if (pio_usb_initialized) pio_usb_host_restart();
+    usb_hw->sie_ctrl = SIE_CTRL_BASE;
+
+    bus_resuming = false;
+    bus_suspended = false;
+    bus_wakeup = false;
+}
+
+bool hcd_hybrid_wakeup_pending(void) {
+    return bus_wakeup;
+}
+
+//--------------------------------------------------------------------+
+// Endpoint Halt Recovery - Task Side
+//--------------------------------------------------------------------+
+
+static void halt_clear_complete(tuh_xfer_t *xfer) {
+    uint8_t const ep_addr = (uint8_t)xfer->user_data;
+    halt_entry_t *h = &halt_queue[halt_tail % HALT_QUEUE_SIZE];
+
+    halt_in_progress = false;
+
+    if (xfer->result == XFER_RESULT_SUCCESS) {
+        hcd_devtree_info_t dev_tree;
+        hcd_devtree_get_info(xfer->daddr, &dev_tree);
+        hcd_edpt_clear_stall(dev_tree.rhport, xfer->daddr, ep_addr);
+    } else if (++h->tries < HALT_RETRIES) {
+        // Left at the head of the queue, hcd_hybrid_task() sends it again
+        return;
+    }
+
+    // Re-arm even after the last failed try: an endpoint that still
+    // stalls queues itself again, one left unarmed would stay dead
+    halt_tail++;
+    hcd_hybrid_halt_cleared_cb(xfer->daddr, ep_addr);
+}
+
+bool hcd_hybrid_edpt_halted(uint8_t dev_addr) {
+    for (uint8_t i = halt_tail; i != halt_head; i++) {
+        if (halt_queue[i % HALT_QUEUE_SIZE].dev_addr == dev_addr) return true;
+    }
+    return false;
+}
+
+uint32_t hcd_hybrid_xfer_time(uint8_t dev_addr) {
+    return dev_addr < XFER_TIME_ADDRS ? xfer_time_us[dev_addr] : time_us_32();
+}
+
+void hcd_hybrid_task(void) {
+    static tusb_control_request_t request;
+
+    if (halt_in_progress || halt_tail == halt_head) return;
+
+    halt_entry_t const *h = &halt_queue[halt_tail % HALT_QUEUE_SIZE];
+
+    request = (tusb_control_request_t){
+        .bmRequestType_bit = {
+            .recipient = TUSB_REQ_RCPT_ENDPOINT,
+            .type = TUSB_REQ_TYPE_STANDARD,
+            .direction = TUSB_DIR_OUT
+        },
+        .bRequest = TUSB_REQ_CLEAR_FEATURE,
+        .wValue = TUSB_REQ_FEATURE_EDPT_HALT,
+        .wIndex = h->ep_addr,
+        .wLength = 0
+    };
+
+    tuh_xfer_t xfer = {
+        .daddr = h->dev_addr,
+        .ep_addr = 0,
+        .setup = &request,
+        .buffer = NULL,
+        .complete_cb = halt_clear_complete,
+        .user_data = h->ep_addr
+    };
+
+    // Control pipe may be busy with enumeration, retry on the next call
+    if (tuh_control_xfer(&xfer)) {
+        halt_in_progress = true;
+    }
 }
 
 #endif // CFG_TUH_RPI_HYBRID_USB
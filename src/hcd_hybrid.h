@@ -0,0 +1,48 @@
+/*
+ * Hecate - Hybrid HCD Driver (Native USB + PIO-USB)
+ *
+ * Application-facing helpers of the hybrid host controller driver.
+ * The HCD API itself is declared by TinyUSB in host/hcd.h.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef HCD_HYBRID_H
+#define HCD_HYBRID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Clear pending endpoint halts (call in main loop after tuh_task)
+void hcd_hybrid_task(void);
+
+// True while a stalled endpoint of this device is waiting to be cleared
+bool hcd_hybrid_edpt_halted(uint8_t dev_addr);
+
+// time_us_32() at the interrupt that completed this device's last IN
+// transfer; the origin of input latency measurements
+uint32_t hcd_hybrid_xfer_time(uint8_t dev_addr);
+
+// Stop SOF on all root ports so attached devices enter USB suspend
+void hcd_hybrid_suspend(void);
+
+// Resume signalling time, USB 2.0 7.1.7.7 (TDRSMDN, at least 20 ms)
+#define HCD_HYBRID_RESUME_US 20000
+
+// Start driving resume (K) on all root ports after hcd_hybrid_suspend();
+// call hcd_hybrid_resume_end() once HCD_HYBRID_RESUME_US have passed
+void hcd_hybrid_resume(void);
+
+// End resume signalling with a low-speed EOP and restart SOF. Devices
+// need 10 ms of recovery after this before they are addressed.
+void hcd_hybrid_resume_end(void);
+
+// True once a device signalled remote wakeup (or line activity) while suspended
+bool hcd_hybrid_wakeup_pending(void);
+
+// Invoked once CLEAR_FEATURE(ENDPOINT_HALT) succeeded and the data toggle
+// was reset, or after its last retry failed; the application re-arms its
+// transfers from here
+void hcd_hybrid_halt_cleared_cb(uint8_t dev_addr, uint8_t ep_addr);
+
+#endif // HCD_HYBRID_H
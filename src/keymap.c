@@ -0,0 +1,153 @@
+/*
+ * Hecate - Key Remapping and Layers
+ *
+ * Remaps physical HID keys before they reach the PS/2 keyboard driver,
+ * replacing external remapping hardware (Caps Lock as Ctrl, function
+ * layers for terminal software without the keys).
+ *
+ * Design:
+ *   - km_layers: dense [layer][usage] tables, const so they stay in flash
+ *   - km_active: the active layers flattened into one RAM table, rebuilt
+ *     only when the set of active layers changes (rare), so a key costs
+ *     one indexed load
+ *   - Layers are active while a KM_LAYER key is held (counted, two keys
+ *     may hold one layer) or while all modifiers of km_layer_mods are
+ *     down; the modifiers themselves still reach the host
+ *   - km_pressed remembers what each physical key was pressed as; its
+ *     release always releases that, whatever the layers are by then
+ *   - km_refs counts the physical keys holding each output, as the
+ *     keyboard merge in main.c does per interface: Caps Lock (as Left
+ *     Ctrl) and Left Ctrl held together make it once and break it when
+ *     the last of them is released
+ *
+ * The shipped tables are identity unless built with PS2_KEYMAP, which
+ * enables the example map below.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "keymap.h"
+#include "ps2_keyboard.h"
+#include "tusb.h"
+
+#if PS2_KEYMAP
+// Example map: Caps Lock is Left Ctrl; holding Right GUI selects a
+// function layer with F1-F12 on the number row and a navigation cluster
+// on the right hand, for terminals and laptops without those keys.
+// Left Ctrl + Left Alt selects a media layer on the function keys.
+static const u8 km_layers[KM_LAYERS][256] = {
+    [0] = {
+        [HID_KEY_CAPS_LOCK]    = HID_KEY_CONTROL_LEFT,
+        [HID_KEY_GUI_RIGHT]    = KM_LAYER(1),
+    },
+    [1] = {
+        [HID_KEY_1]            = HID_KEY_F1,
+        [HID_KEY_2]            = HID_KEY_F2,
+        [HID_KEY_3]            = HID_KEY_F3,
+        [HID_KEY_4]            = HID_KEY_F4,
+        [HID_KEY_5]            = HID_KEY_F5,
+        [HID_KEY_6]            = HID_KEY_F6,
+        [HID_KEY_7]            = HID_KEY_F7,
+        [HID_KEY_8]            = HID_KEY_F8,
+        [HID_KEY_9]            = HID_KEY_F9,
+        [HID_KEY_0]            = HID_KEY_F10,
+        [HID_KEY_MINUS]        = HID_KEY_F11,
+        [HID_KEY_EQUAL]        = HID_KEY_F12,
+        [HID_KEY_I]            = HID_KEY_ARROW_UP,
+        [HID_KEY_J]            = HID_KEY_ARROW_LEFT,
+        [HID_KEY_K]            = HID_KEY_ARROW_DOWN,
+        [HID_KEY_L]            = HID_KEY_ARROW_RIGHT,
+        [HID_KEY_U]            = HID_KEY_HOME,
+        [HID_KEY_O]            = HID_KEY_END,
+        [HID_KEY_Y]            = HID_KEY_PAGE_UP,
+        [HID_KEY_H]            = HID_KEY_PAGE_DOWN,
+        [HID_KEY_P]            = HID_KEY_INSERT,
+        [HID_KEY_BACKSPACE]    = HID_KEY_DELETE,
+    },
+    [2] = {
+        [HID_KEY_F1]           = HID_KEY_MUTE,
+        [HID_KEY_F2]           = HID_KEY_VOLUME_DOWN,
+        [HID_KEY_F3]           = HID_KEY_VOLUME_UP,
+    },
+};
+
+// Modifier masks (HID report bit order) that activate a layer, 0 = none
+static const u8 km_layer_mods[KM_LAYERS] = {
+    [2] = KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_LEFTALT,
+};
+#else
+static const u8 km_layers[KM_LAYERS][256] = { { 0 } };
+static const u8 km_layer_mods[KM_LAYERS] = { 0 };
+#endif
+
+static u8 km_active[256];           // Output for each physical key
+static u8 km_pressed[256];          // Output each held key was pressed as
+static u8 km_refs[256];             // Physical keys holding each output
+static u8 km_hold[KM_LAYERS];       // KM_LAYER keys held per layer
+static u8 km_mods;                  // Physical modifiers down
+static u8 km_layer_mask = 1;        // Layers km_active was built from
+
+// Flatten the active layers, top one first, falling through KM_TRANS
+// down to the physical key itself
+static void km_build(u8 mask) {
+    for (u16 key = 0; key < 256; key++) {
+        u8 out = key;
+        for (s8 n = KM_LAYERS - 1; n >= 0; n--) {
+            if (!(mask >> n & 1) || km_layers[n][key] == KM_TRANS) continue;
+            out = km_layers[n][key];
+            break;
+        }
+        km_active[key] = out;
+    }
+    km_layer_mask = mask;
+}
+
+static void km_update(void) {
+    u8 mask = 1;
+    for (u8 n = 1; n < KM_LAYERS; n++) {
+        bool mods = km_layer_mods[n] && (km_mods & km_layer_mods[n]) == km_layer_mods[n];
+        if (km_hold[n] || mods) mask |= 1 << n;
+    }
+    if (mask != km_layer_mask) km_build(mask);
+}
+
+void keymap_init(void) {
+    km_build(1);
+}
+
+void keymap_key(u8 key, bool pressed) {
+    if (key >= HID_KEY_CONTROL_LEFT && key <= HID_KEY_GUI_RIGHT) {
+        u8 bit = 1 << (key - HID_KEY_CONTROL_LEFT);
+        km_mods = pressed ? km_mods | bit : km_mods & ~bit;
+    }
+
+    u8 out;
+    if (pressed) {
+        out = km_active[key];
+        km_pressed[key] = out;
+    } else {
+        // Nothing recorded: a release without a press, pass it through
+        out = km_pressed[key] ? km_pressed[key] : key;
+        km_pressed[key] = KM_TRANS;
+    }
+
+    if (KM_IS_LAYER(out)) {
+        u8 n = out - KM_LAYER(0);
+        if (pressed) {
+            km_hold[n]++;
+        } else if (km_hold[n]) {
+            km_hold[n]--;
+        }
+    } else if (out == KM_NONE) {
+        // Swallowed
+    } else if (pressed) {
+        if (km_refs[out]++ == 0) ps2_keyboard_send_key(out, true);
+    } else if (km_refs[out]) {
+        if (--km_refs[out] == 0) ps2_keyboard_send_key(out, false);
+    } else {
+        // Release nothing holds (a key down since before boot)
+        ps2_keyboard_send_key(out, false);
+    }
+
+    km_update();
+}
@@ -0,0 +1,36 @@
+/*
+ * Hecate - Key Remapping and Layers
+ *
+ * Public interface for the remap stage between HID report decoding and
+ * ps2_keyboard_send_key(). Layer tables are const arrays in flash; the
+ * active layers are resolved into one RAM table, so a lookup is a single
+ * indexed load.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "ps2out.h"
+
+// Layers, layer 0 is the base layer and always active
+#define KM_LAYERS 4
+
+// Table entries besides plain HID usages. 0x00 and 0x01 are never
+// reported as keys (no event / ErrorRollOver), 0xf0-0xff are reserved
+// usages.
+#define KM_TRANS       0x00            // Use the next lower active layer
+#define KM_NONE        0x01            // Key does nothing
+#define KM_LAYER(n)    (0xf0 + (n))    // Layer n active while held
+#define KM_IS_LAYER(k) ((k) >= 0xf0 && (k) < 0xf0 + KM_LAYERS)
+
+// Resolve the base layer (call once at boot)
+void keymap_init(void);
+
+// Remap one physical key transition and pass the result on to
+// ps2_keyboard_send_key(). A key is released as whatever it was pressed
+// as, so layer changes while keys are held never leave one stuck.
+void keymap_key(u8 key, bool pressed);
+
+#endif // KEYMAP_H
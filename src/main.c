@@ -15,22 +15,40 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <stdio.h>
 #include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/clocks.h"
 #include "bsp/board_api.h"
 #include "ps2_keyboard.h"
 #include "ps2_mouse.h"
+#include "keymap.h"
 #include "led.h"
+#include "power.h"
+#include "timer_wheel.h"
 #include "pio_usb.h"
 #include "tusb.h"
 
+#if PS2_ANALYZER
+#include "ps2sniff.h"
+#endif
+
+#if CFG_TUH_RPI_HYBRID_USB
+#include "hcd_hybrid.h"
+#endif
+
 // Dual PIO-USB Host GPIO configuration
 // Port 0: GPIO 2 (D+) / GPIO 3 (D-)
 // Port 1: GPIO 4 (D+) / GPIO 5 (D-) - added via pio_usb_host_add_port
 #define USB0_DP_PIN 2
 #define USB1_DP_PIN 4
 
+// Settle time between bringing up USB port 0 and adding port 1
+#define USB1_ADD_DELAY_US 100000
+
+// Print the boot timeline after this long even if it is incomplete
+#define BOOT_TRACE_TIMEOUT_US 10000000
+
 //--------------------------------------------------------------------
 // HID Report Parsing Structures
 //--------------------------------------------------------------------
@@ -40,6 +58,9 @@
 #define MAX_REPORT 8
 #define MAX_REPORT_ITEMS 32
 
+// Usage reported in every key slot while a keyboard is in phantom state
+#define KB_ERR_ROLLOVER 0x01
+
 typedef struct {
     u16 page;
     u16 usage;
@@ -90,6 +111,11 @@ typedef struct {
     u8 nkro[MAX_NKRO];
     bool leds;
     bool is_mouse;
+    u8 led_report_id;   // Report ID of the keyboard's LED output report
+    u8 led_buf;         // Output report payload, must outlive the transfer
+    u8 led_sent;        // Last LED state written, KB_LED_UNKNOWN after mount
+    bool led_busy;      // Write in flight
+    bool led_no_out;    // No interrupt OUT endpoint, use SET_REPORT
 } hid_instance_t;
 
 static hid_instance_t hid_info[CFG_TUH_HID];
@@ -99,10 +125,10 @@ static ms_items_t ms_items;
 static u8 kb_connected_count = 0;
 static u8 ms_connected_count = 0;
 
-// LED sync variables
-static u8 kb_inst_loop = 0;
-static u8 kb_last_dev = 0;
-extern u8 kb_set_led;
+// Keyboard LED fan-out
+#define KB_LED_UNKNOWN 0xff
+static bool kb_led_dirty = false;
+static u8 kb_led_state = 0;
 
 //--------------------------------------------------------------------
 // HID Report Descriptor Parsing
@@ -313,7 +339,7 @@ static void ms_setup(hid_report_info_t *info) {
     hid_parse_find_bit_item_by_page(info, 8, HID_USAGE_PAGE_BUTTON, 4, &ms_items.fw);
 }
 
-static void ms_report_receive(u8 const* report, u16 len) {
+static void ms_report_receive(u8 const* report, u16 len, u32 origin) {
     static u8 prev_buttons = 0;
     u8 buttons = 0;
     s8 x, y, z;
@@ -334,37 +360,261 @@ static void ms_report_receive(u8 const* report, u16 len) {
         prev_buttons = buttons;
     }
 
-    ps2_mouse_send_movement(buttons, x, y, z);
+    ps2_mouse_send_movement(buttons, x, y, z, origin);
 }
 
 //--------------------------------------------------------------------
-// LED Sync Callback
+// Keyboard LEDs
+//
+// The selected PS/2 host's LED state (0xED) goes to every mounted USB
+// keyboard: on the interrupt OUT endpoint where the interface has one,
+// else with SET_REPORT on the control pipe. Each interface remembers
+// what it was last sent, so only changes go out, and a keyboard plugged
+// in later starts out unknown and gets the current state.
 //--------------------------------------------------------------------
 
-s64 kb_led_sync_callback(alarm_id_t id, void *user_data) {
-    (void)id;
-    (void)user_data;
-    
-    if (hid_info[kb_inst_loop].leds && kb_last_dev != hid_info[kb_inst_loop].dev_addr) {
-        tuh_hid_set_report(hid_info[kb_inst_loop].dev_addr, kb_inst_loop, 0, HID_REPORT_TYPE_OUTPUT, &kb_set_led, 1);
-        kb_last_dev = hid_info[kb_inst_loop].dev_addr;
+static void kb_led_write(u8 instance) {
+    hid_instance_t* hid = &hid_info[instance];
+
+    hid->led_buf = kb_led_state;
+    if (!hid->led_no_out) {
+        // A refusal (endpoint claimed, device not configured yet) is
+        // retried from kb_led_task(), still on the endpoint
+        if (tuh_hid_send_report(hid->dev_addr, instance, hid->led_report_id, &hid->led_buf, 1)) {
+            hid->led_busy = true;
+            hid->led_sent = kb_led_state;
+        }
+        return;
+    }
+
+    if (tuh_hid_set_report(hid->dev_addr, instance, hid->led_report_id, HID_REPORT_TYPE_OUTPUT,
+                           &hid->led_buf, 1)) {
+        hid->led_busy = true;
+        hid->led_sent = kb_led_state;
+    }
+}
+
+static void kb_led_task(void) {
+    u8 leds = ps2_keyboard_leds();
+    if (leds != kb_led_state) {
+        kb_led_state = leds;
+        kb_led_dirty = true;
+    }
+    if (!kb_led_dirty || power_is_suspended()) return;
+
+    // Stays dirty while any keyboard is behind, busy or refused
+    kb_led_dirty = false;
+    for (u8 i = 0; i < CFG_TUH_HID; i++) {
+        hid_instance_t* hid = &hid_info[i];
+        if (!hid->leds || hid->led_sent == kb_led_state) continue;
+        if (!hid->led_busy) kb_led_write(i);
+        if (hid->led_sent != kb_led_state || hid->led_busy) kb_led_dirty = true;
+    }
+}
+
+static void kb_led_done(u8 instance) {
+    if (instance >= CFG_TUH_HID) return;
+    hid_info[instance].led_busy = false;
+    kb_led_dirty = true;
+}
+
+// A failed write is not retried: the next state change tries again
+void tuh_hid_report_sent_cb(u8 dev_addr, u8 instance, u8 const* report, u16 len) {
+    (void)dev_addr;
+    (void)report;
+    (void)len;
+    kb_led_done(instance);
+}
+
+void tuh_hid_set_report_complete_cb(u8 dev_addr, u8 instance, u8 report_id, u8 report_type, u16 len) {
+    (void)dev_addr;
+    (void)report_id;
+    (void)report_type;
+    (void)len;
+    kb_led_done(instance);
+}
+
+//--------------------------------------------------------------------
+// Host Switching
+//
+// With PS2_HOST_COUNT > 1, Right Ctrl + Right Alt + 1/2 selects the PS/2
+// host that gets USB input. Every host keeps its own keyboard and mouse
+// state and USB devices stay mounted, so switching is instant; keys and
+// buttons held on the old host are released there.
+//--------------------------------------------------------------------
+
+#if PS2_HOST_COUNT > 1
+static u8 host_hotkey_mods = 0;
+static u8 host_swallow_mods = 0;    // Chord modifiers still down from a switch
+static u8 host_swallow_key = 0;     // Digit still down from a switch
+
+static void host_select(u8 index) {
+    ps2_keyboard_select_host(index);
+    ps2_mouse_select_host(index);
+    printf("PS/2 host %d selected\n", index + 1);
+}
+#endif
+
+// Key event filter in front of the keymap. Hotkeys match physical keys,
+// so a remap can never take them away.
+static void kb_send_key(u8 key, bool state) {
+#if PS2_HOST_COUNT > 1
+    if (key == HID_KEY_CONTROL_RIGHT || key == HID_KEY_ALT_RIGHT) {
+        u8 bit = key == HID_KEY_CONTROL_RIGHT ? 1 : 2;
+        host_hotkey_mods = state ? host_hotkey_mods | bit : host_hotkey_mods & ~bit;
+
+        // The chord's makes went to the old host and were released there;
+        // the new host must not see their breaks
+        if (!state && host_swallow_mods & bit) {
+            host_swallow_mods &= ~bit;
+            return;
+        }
+    }
+
+    if (!state && key == host_swallow_key) {
+        host_swallow_key = 0;
+        return;
+    }
+
+    if (host_hotkey_mods == 3 && key >= HID_KEY_1 && key < HID_KEY_1 + PS2_HOST_COUNT) {
+        if (state) {
+            host_select(key - HID_KEY_1);
+            host_swallow_mods = 3;
+            host_swallow_key = key;
+        }
+        return;
+    }
+#endif
+
+    keymap_key(key, state);
+}
+
+//--------------------------------------------------------------------
+// Boot Sequencer
+//
+// PS/2 ports are live from the first main loop iteration; USB ports are
+// brought up from the same loop without blocking. Milestones are stamped
+// in microseconds since reset and printed once as a boot timeline.
+//--------------------------------------------------------------------
+
+typedef enum {
+    BOOT_EV_RESET,
+    BOOT_EV_KB_BAT,
+    BOOT_EV_MS_BAT,
+    BOOT_EV_USB_UP,
+    BOOT_EV_FIRST_MOUNT,
+    BOOT_EV_FIRST_KEY,
+    BOOT_EV_COUNT
+} boot_event_t;
+
+static const char* const boot_ev_names[BOOT_EV_COUNT] = {
+    "reset", "kb BAT sent", "ms BAT sent", "usb ports up", "first mount", "first key ready"
+};
+
+static u32 boot_ev_us[BOOT_EV_COUNT];
+static u8 boot_ev_seen = 1 << BOOT_EV_RESET;
+static bool boot_trace_printed = false;
+static bool usb1_added = false;
+static u32 usb1_add_us = 0;
+
+static void boot_mark(boot_event_t ev) {
+    if (boot_ev_seen & (1 << ev)) return;
+    boot_ev_seen |= 1 << ev;
+    boot_ev_us[ev] = time_us_32();
+}
+
+static void boot_task(void) {
+    // Add PIO-USB port 1 (GPIO 4/5) once port 0 had time to settle
+    if (!usb1_added && (s32)(time_us_32() - usb1_add_us) >= 0) {
+        pio_usb_host_add_port(USB1_DP_PIN, PIO_USB_PINOUT_DPDM);
+        usb1_added = true;
+        boot_mark(BOOT_EV_USB_UP);
+    }
+
+    if (boot_trace_printed) return;
+
+    if (ps2_keyboard_bat_sent(0)) boot_mark(BOOT_EV_KB_BAT);
+    if (ps2_mouse_bat_sent(0)) boot_mark(BOOT_EV_MS_BAT);
+    if (kb_connected_count > 0 && ps2_keyboard_ready(0)) boot_mark(BOOT_EV_FIRST_KEY);
+
+    if (boot_ev_seen != (1 << BOOT_EV_COUNT) - 1 && time_us_32() < BOOT_TRACE_TIMEOUT_US) return;
+
+    printf("Boot timeline:\n");
+    for (u8 i = 0; i < BOOT_EV_COUNT; i++) {
+        if (boot_ev_seen & (1 << i)) {
+            printf("  %-16s %8lu us\n", boot_ev_names[i], (unsigned long)boot_ev_us[i]);
+        } else {
+            printf("  %-16s        - \n", boot_ev_names[i]);
+        }
+    }
+    boot_trace_printed = true;
+}
+
+//--------------------------------------------------------------------
+// Keyboard Merge
+//
+// All keyboards feed one PS/2 keyboard. Each key carries a count of the
+// interfaces holding it: the first press makes it, the last release
+// breaks it, so two keyboards holding one key never produce a duplicate
+// make or an early break. Every interface keeps its own last report, so
+// unplugging releases exactly the keys it held, in time proportional to
+// its own report and independent of the number of devices.
+//--------------------------------------------------------------------
+
+static u8 kb_key_refs[256];
+
+static void kb_merge_key(u8 key, bool state) {
+    if (state) {
+        if (kb_key_refs[key]++ == 0) kb_send_key(key, true);
+    } else if (kb_key_refs[key]) {
+        if (--kb_key_refs[key] == 0) kb_send_key(key, false);
     }
+}
 
-    kb_inst_loop++;
+// Release everything an interface reported as held, and forget it
+static void kb_release_instance(u8 instance) {
+    hid_instance_t* hid = &hid_info[instance];
 
-    if (kb_inst_loop == CFG_TUH_HID) {
-        kb_inst_loop = 0;
-        kb_last_dev = 0;
-        return 0;
+    for (u8 i = 0; i < 8; i++) {
+        if (hid->modifiers >> i & 1) kb_merge_key(i + HID_KEY_CONTROL_LEFT, false);
+    }
+    for (u8 i = 0; i < MAX_BOOT; i++) {
+        if (hid->boot[i]) kb_merge_key(hid->boot[i], false);
+    }
+    for (u8 i = 0; i < MAX_NKRO; i++) {
+        for (u8 j = 0; hid->nkro[i] >> j; j++) {
+            if (hid->nkro[i] >> j & 1) kb_merge_key(i * 8 + j, false);
+        }
     }
 
-    return 1000;
+    hid->modifiers = 0;
+    memset(hid->boot, 0, MAX_BOOT);
+    memset(hid->nkro, 0, MAX_NKRO);
 }
 
 //--------------------------------------------------------------------
 // TinyUSB HID Host Callbacks
 //--------------------------------------------------------------------
 
+// A HID interface always has its interrupt IN endpoint; a second one is
+// the optional interrupt OUT endpoint
+static bool kb_led_has_out(u8 dev_addr, u8 instance) {
+    tuh_itf_info_t info;
+    return tuh_hid_itf_get_info(dev_addr, instance, &info) && info.desc.bNumEndpoints >= 2;
+}
+
+// Report ID the keyboard's LED output report shares with its key input
+// report (0 for boot protocol and single-report devices)
+static u8 kb_led_report_id(u8 instance) {
+    for (u8 i = 0; i < hid_info[instance].report_count; i++) {
+        hid_report_info_t* info = &hid_info[instance].report_info[i];
+        if (info->usage_page == HID_USAGE_PAGE_DESKTOP && info->usage == HID_USAGE_DESKTOP_KEYBOARD) {
+            return info->report_id;
+        }
+    }
+    return 0;
+}
+
 void tuh_hid_mount_cb(u8 dev_addr, u8 instance, u8 const* desc_report, u16 desc_len) {
     if (desc_report == NULL && desc_len == 0) {
         return;
@@ -380,17 +630,23 @@ void tuh_hid_mount_cb(u8 dev_addr, u8 instance, u8 const* desc_report, u16 desc_
     }
 
     if (tuh_hid_receive_report(dev_addr, instance)) {
+        boot_mark(BOOT_EV_FIRST_MOUNT);
+        hid_info[instance].dev_addr = dev_addr;
         if (hid_if_proto == HID_ITF_PROTOCOL_MOUSE) {
             hid_info[instance].leds = false;
             hid_info[instance].is_mouse = true;
             ms_connected_count++;
         } else {
-            hid_info[instance].dev_addr = dev_addr;
             hid_info[instance].modifiers = 0;
             memset(hid_info[instance].boot, 0, MAX_BOOT);
             memset(hid_info[instance].nkro, 0, MAX_NKRO);
             hid_info[instance].leds = true;
             hid_info[instance].is_mouse = false;
+            hid_info[instance].led_report_id = kb_led_report_id(instance);
+            hid_info[instance].led_sent = KB_LED_UNKNOWN;
+            hid_info[instance].led_busy = false;
+            hid_info[instance].led_no_out = !kb_led_has_out(dev_addr, instance);
+            kb_led_dirty = true;
             kb_connected_count++;
         }
         led_set_connected(kb_connected_count > 0, ms_connected_count > 0);
@@ -403,6 +659,11 @@ void tuh_hid_umount_cb(u8 dev_addr, u8 instance) {
         if (ms_connected_count > 0) ms_connected_count--;
     } else if (hid_info[instance].leds) {
         if (kb_connected_count > 0) kb_connected_count--;
+
+        // Keys still down on the unplugged keyboard go up on the host
+        ps2_keyboard_batch_begin(time_us_32());
+        kb_release_instance(instance);
+        ps2_keyboard_batch_end();
     }
     hid_info[instance].dev_addr = 0;
     hid_info[instance].leds = false;
@@ -410,60 +671,26 @@ void tuh_hid_umount_cb(u8 dev_addr, u8 instance) {
     led_set_connected(kb_connected_count > 0, ms_connected_count > 0);
 }
 
-void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16 len) {
-    u8 const rpt_count = hid_info[instance].report_count;
-    hid_report_info_t *rpt_infos = hid_info[instance].report_info;
-    hid_report_info_t *rpt_info = NULL;
-
-    if (rpt_count == 1 && rpt_infos[0].report_id == 0) {
-        rpt_info = &rpt_infos[0];
-    } else {
-        u8 const rpt_id = report[0];
-        for (u8 i = 0; i < rpt_count; i++) {
-            if (rpt_id == rpt_infos[i].report_id) {
-                rpt_info = &rpt_infos[i];
-                break;
-            }
-        }
-        report++;
-        len--;
-    }
-
-    if (!rpt_info) {
-        tuh_hid_receive_report(dev_addr, instance);
-        return;
-    }
-    
-    tuh_hid_receive_report(dev_addr, instance);
-
-    // Handle mouse reports
-    if (tuh_hid_interface_protocol(dev_addr, instance) == HID_ITF_PROTOCOL_MOUSE) {
-        if (tuh_hid_get_protocol(dev_addr, instance) == HID_PROTOCOL_BOOT) {
-            // Boot protocol mouse - blink on button press
-            static u8 prev_buttons = 0;
-            if (report[0] != prev_buttons) {
-                led_blink_activity();
-                prev_buttons = report[0];
-            }
-            ps2_mouse_send_movement(report[0], report[1], report[2], len > 3 ? report[3] : 0);
-        } else if (rpt_info->usage_page == HID_USAGE_PAGE_DESKTOP && rpt_info->usage == HID_USAGE_DESKTOP_MOUSE) {
-            ms_setup(rpt_info);
-            ms_report_receive(report, len);
+#if CFG_TUH_RPI_HYBRID_USB
+void hcd_hybrid_halt_cleared_cb(u8 dev_addr, u8 ep_addr) {
+    (void)ep_addr;
+    // Re-arm every interface of the device, busy ones are left alone
+    for (u8 i = 0; i < CFG_TUH_HID; i++) {
+        if (hid_info[i].dev_addr == dev_addr) {
+            tuh_hid_receive_report(dev_addr, i);
         }
-        return;
-    }
-
-    // Handle keyboard reports
-    if (rpt_info->usage_page != HID_USAGE_PAGE_DESKTOP || rpt_info->usage != HID_USAGE_DESKTOP_KEYBOARD) {
-        return;
     }
+}
+#endif
 
+// Turn one keyboard report into key transitions, modifiers first
+static void kb_report_receive(u8 instance, u8 const* report, u16 len) {
     // Process modifier changes
     if (report[0] != hid_info[instance].modifiers) {
         led_blink_activity();
         for (u8 i = 0; i < 8; i++) {
             if ((report[0] >> i & 1) != (hid_info[instance].modifiers >> i & 1)) {
-                ps2_keyboard_send_key(i + HID_KEY_CONTROL_LEFT, report[0] >> i & 1);
+                kb_merge_key(i + HID_KEY_CONTROL_LEFT, report[0] >> i & 1);
             }
         }
         hid_info[instance].modifiers = report[0];
@@ -474,12 +701,15 @@ void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16
 
     // NKRO handling (len > 12 and < 31)
     if (len > 12 && len < 31) {
+        // Phantom state (ErrorRollOver bit): keep the keys as they were
+        if (report[0] & (1 << KB_ERR_ROLLOVER)) return;
+
         bool key_changed = false;
         for (u8 i = 0; i < len && i < MAX_NKRO; i++) {
             for (u8 j = 0; j < 8; j++) {
                 if ((report[i] >> j & 1) != (hid_info[instance].nkro[i] >> j & 1)) {
                     key_changed = true;
-                    ps2_keyboard_send_key(i * 8 + j, report[i] >> j & 1);
+                    kb_merge_key(i * 8 + j, report[i] >> j & 1);
                 }
             }
         }
@@ -495,6 +725,12 @@ void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16
             report++;
             // fall through
         case 6: {
+            // Phantom state (ErrorRollOver in the key array): keep the
+            // keys as they were rather than break and remake them all
+            for (u8 i = 0; i < MAX_BOOT; i++) {
+                if (report[i] == KB_ERR_ROLLOVER) return;
+            }
+
             bool key_changed = false;
             // Check for released keys
             for (u8 i = 0; i < MAX_BOOT; i++) {
@@ -508,7 +744,7 @@ void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16
                     }
                     if (brk) {
                         key_changed = true;
-                        ps2_keyboard_send_key(hid_info[instance].boot[i], false);
+                        kb_merge_key(hid_info[instance].boot[i], false);
                     }
                 }
             }
@@ -525,7 +761,7 @@ void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16
                     }
                     if (make) {
                         key_changed = true;
-                        ps2_keyboard_send_key(report[i], true);
+                        kb_merge_key(report[i], true);
                     }
                 }
             }
@@ -537,6 +773,130 @@ void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16
     }
 }
 
+// Time a device's last report left the bus, the origin of the latency
+// statistics. Interfaces of one device share the stamp, so it is read
+// before the report endpoint is re-armed.
+static u32 report_origin(u8 dev_addr) {
+#if CFG_TUH_RPI_HYBRID_USB
+    return hcd_hybrid_xfer_time(dev_addr);
+#else
+    (void)dev_addr;
+    return time_us_32();
+#endif
+}
+
+void tuh_hid_report_received_cb(u8 dev_addr, u8 instance, u8 const* report, u16 len) {
+    u32 origin = report_origin(dev_addr);
+
+#if CFG_TUH_RPI_HYBRID_USB
+    // Stalled interrupt endpoint: re-armed from hcd_hybrid_halt_cleared_cb()
+    if (len == 0 && hcd_hybrid_edpt_halted(dev_addr)) {
+        return;
+    }
+#endif
+
+    if (len == 0) {
+        tuh_hid_receive_report(dev_addr, instance);
+        return;
+    }
+
+    u8 const rpt_count = hid_info[instance].report_count;
+    hid_report_info_t *rpt_infos = hid_info[instance].report_info;
+    hid_report_info_t *rpt_info = NULL;
+
+    if (rpt_count == 1 && rpt_infos[0].report_id == 0) {
+        rpt_info = &rpt_infos[0];
+    } else {
+        u8 const rpt_id = report[0];
+        for (u8 i = 0; i < rpt_count; i++) {
+            if (rpt_id == rpt_infos[i].report_id) {
+                rpt_info = &rpt_infos[i];
+                break;
+            }
+        }
+        report++;
+        len--;
+    }
+
+    if (!rpt_info) {
+        tuh_hid_receive_report(dev_addr, instance);
+        return;
+    }
+    
+    tuh_hid_receive_report(dev_addr, instance);
+
+    // Handle mouse reports
+    if (tuh_hid_interface_protocol(dev_addr, instance) == HID_ITF_PROTOCOL_MOUSE) {
+        if (tuh_hid_get_protocol(dev_addr, instance) == HID_PROTOCOL_BOOT) {
+            // Boot protocol mouse - blink on button press
+            static u8 prev_buttons = 0;
+            if (report[0] != prev_buttons) {
+                led_blink_activity();
+                prev_buttons = report[0];
+            }
+            ps2_mouse_send_movement(report[0], report[1], report[2], len > 3 ? report[3] : 0,
+                                    origin);
+        } else if (rpt_info->usage_page == HID_USAGE_PAGE_DESKTOP && rpt_info->usage == HID_USAGE_DESKTOP_MOUSE) {
+            ms_setup(rpt_info);
+            ms_report_receive(report, len, origin);
+        }
+        return;
+    }
+
+    // Handle keyboard reports
+    if (rpt_info->usage_page != HID_USAGE_PAGE_DESKTOP || rpt_info->usage != HID_USAGE_DESKTOP_KEYBOARD) {
+        return;
+    }
+
+    // Every transition in this report goes out as one batch
+    ps2_keyboard_batch_begin(origin);
+    kb_report_receive(instance, report, len);
+    ps2_keyboard_batch_end();
+}
+
+//--------------------------------------------------------------------
+// Debug Console
+//
+// Single-key commands on the UART: 's' prints PS/2 port, typematic,
+// mouse sample clock and timer statistics, 'l' input latency per port,
+// 'r' clears both, 'a' dumps the line analyzer capture.
+//--------------------------------------------------------------------
+
+static void console_task(void) {
+    int c = getchar_timeout_us(0);
+
+    switch (c) {
+        case 's':
+            ps2out_print_stats();
+            ps2_keyboard_print_stats();
+            ps2_mouse_print_stats();
+            tw_print_stats();
+            break;
+
+        case 'l':
+            ps2out_print_latency();
+            break;
+
+        case 'r':
+            ps2out_reset_stats();
+            ps2_keyboard_reset_stats();
+            ps2_mouse_reset_stats();
+            tw_reset_stats();
+            ps2out_reset_latency();
+            printf("Stats cleared\n");
+            break;
+
+#if PS2_ANALYZER
+        case 'a':
+            ps2sniff_dump();
+            break;
+#endif
+
+        default:
+            break;
+    }
+}
+
 //--------------------------------------------------------------------
 // Main
 //--------------------------------------------------------------------
@@ -551,8 +911,12 @@ int main() {
     // Initialize LED driver
     led_init();
 
+    // Shared timer wheel for PS/2 timing
+    tw_init();
+
     // Initialize PS/2 keyboard emulation
     ps2_keyboard_init();
+    keymap_init();
 
     // Initialize PS/2 mouse emulation
     ps2_mouse_init();
@@ -572,15 +936,6 @@ int main() {
     tuh_configure(1, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
     tuh_init(1);
 
-    // Run a few USB task cycles to let ports stabilize
-    for (int i = 0; i < 100; i++) {
-        tuh_task();
-        sleep_ms(1);
-    }
-
-    // Add PIO-USB port 1 (GPIO 4/5) as additional root port
-    pio_usb_host_add_port(USB1_DP_PIN, PIO_USB_PINOUT_DPDM);
-
 #else
     // PIO-USB only mode
 
@@ -590,29 +945,33 @@ int main() {
     tuh_configure(0, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
     tuh_init(0);
 
-    // Run a few USB task cycles to let port 0 stabilize
-    for (int i = 0; i < 100; i++) {
-        tuh_task();
-        sleep_ms(1);
-    }
+#endif
 
-    // Add USB port 1 (GPIO 4/5) as additional root port
-    pio_usb_host_add_port(USB1_DP_PIN, PIO_USB_PINOUT_DPDM);
+    // USB port 1 is added from boot_task() once port 0 has settled, while
+    // the PS/2 ports already answer the host
+    usb1_add_us = time_us_32() + USB1_ADD_DELAY_US;
 
-#endif
+    // Suspend USB and sleep while no PS/2 host is listening
+    power_init();
 
-    // Allow ports to enumerate connected devices
-    for (int i = 0; i < 100; i++) {
-        tuh_task();
-        sleep_ms(1);
-    }
+#if PS2_ANALYZER
+    // Passive capture of the PS/2 lines on the PIO SMs left free
+    ps2sniff_init();
+#endif
 
     // Main loop
     while (true) {
         tuh_task();
+#if CFG_TUH_RPI_HYBRID_USB
+        hcd_hybrid_task();
+#endif
         ps2_keyboard_task();
         ps2_mouse_task();
+        boot_task();
+        kb_led_task();
+        console_task();
         led_task();
+        power_task();
     }
 
     return 0;
@@ -0,0 +1,271 @@
+/*
+ * Hecate - Power Management
+ *
+ * Detects when no PS/2 host is listening and drops into a low-power
+ * state until one is again.
+ *
+ * A PS/2 channel counts as idle when the host holds its CLK line low for
+ * longer than any inhibit (host powered down on standby power), or has
+ * disabled it (0xF5). Once every channel of every host stays idle, every mounted USB
+ * device is armed for remote wakeup, SOF is stopped so the devices enter
+ * USB suspend, and the core waits for interrupts instead of spinning.
+ *
+ * Wake sources:
+ *   - Any edge on a PS/2 CLK line (host powers up or sends a command)
+ *   - USB remote wakeup or line activity on a root port
+ *
+ * On wake the root ports are driven with resume signalling for 20 ms,
+ * then SOF restarts and the devices get the 10 ms resume recovery time
+ * before the host is back to normal operation.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "power.h"
+#include "ps2_keyboard.h"
+#include "ps2_mouse.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+#include <stdio.h>
+
+#if CFG_TUH_RPI_HYBRID_USB
+#include "hcd_hybrid.h"
+#endif
+
+// CLK held low this long means the host is off, not just inhibiting
+#define POWER_HOST_OFF_US   500000
+
+// Both channels idle this long before suspending
+#define POWER_IDLE_US       2000000
+
+// USB resume recovery time (TRSMRCY) after resume signalling ends,
+// before devices are addressed again
+#define POWER_RESUME_US     10000
+
+typedef enum {
+    POWER_ACTIVE,
+    POWER_ARMING,       // Enabling remote wakeup on mounted devices
+    POWER_SUSPENDED,
+    POWER_WAKING,       // Driving resume signalling on the USB ports
+    POWER_RESUMING      // Resume recovery
+} power_state_t;
+
+static power_state_t power_state = POWER_ACTIVE;
+static volatile bool power_wake = false;
+static u32 power_kb_clk_high_us[PS2_HOST_COUNT];
+static u32 power_ms_clk_high_us[PS2_HOST_COUNT];
+static u32 power_busy_us = 0;
+static u32 power_resume_us = 0;     // Start of the current wake phase
+static u8 power_arm_addr = 0;
+static bool power_arm_pending = false;
+
+// PS/2 CLK pins per host
+static const u8 power_kb_clk_pins[2] = { PS2_KB_CLK_PIN, PS2_KB1_CLK_PIN };
+static const u8 power_ms_clk_pins[2] = { PS2_MOUSE_CLK_PIN, PS2_MOUSE1_CLK_PIN };
+
+static void power_gpio_ack(u8 pin) {
+    u32 events = gpio_get_irq_event_mask(pin);
+    if (events) {
+        gpio_acknowledge_irq(pin, events);
+        power_wake = true;
+    }
+}
+
+static void power_gpio_irq(void) {
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        power_gpio_ack(power_kb_clk_pins[i]);
+        power_gpio_ack(power_ms_clk_pins[i]);
+    }
+}
+
+static void power_wake_irq_enable(bool enable) {
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        gpio_set_irq_enabled(power_kb_clk_pins[i], GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, enable);
+        gpio_set_irq_enabled(power_ms_clk_pins[i], GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, enable);
+    }
+}
+
+static bool power_clk_held_low(u8 pin, u32* high_us, u32 now) {
+    if (gpio_get(pin)) {
+        *high_us = now;
+        return false;
+    }
+    if (now - *high_us <= POWER_HOST_OFF_US) return false;
+
+    // Keep the elapsed time saturated so it survives timer wrap-around
+    *high_us = now - POWER_HOST_OFF_US - 1;
+    return true;
+}
+
+static bool power_hosts_idle(u32 now) {
+    bool idle = true;
+
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        bool kb_off = power_clk_held_low(power_kb_clk_pins[i], &power_kb_clk_high_us[i], now);
+        bool ms_off = power_clk_held_low(power_ms_clk_pins[i], &power_ms_clk_high_us[i], now);
+
+        bool kb_idle = kb_off || !ps2_keyboard_ready(i);
+        bool ms_idle = ms_off || !ps2_mouse_reporting(i);
+
+        idle = idle && kb_idle && ms_idle;
+    }
+
+    return idle;
+}
+
+static void power_arm_complete(tuh_xfer_t* xfer) {
+    (void)xfer;
+    // Devices without remote wakeup STALL the request, that is fine
+    power_arm_pending = false;
+    power_arm_addr++;
+}
+
+// Enable remote wakeup on the next mounted device, true when all are done
+static bool power_arm_devices(void) {
+    static tusb_control_request_t request;
+
+    if (power_arm_pending) return false;
+
+    while (power_arm_addr <= CFG_TUH_DEVICE_MAX + CFG_TUH_HUB) {
+        if (!tuh_mounted(power_arm_addr)) {
+            power_arm_addr++;
+            continue;
+        }
+
+        request = (tusb_control_request_t){
+            .bmRequestType_bit = {
+                .recipient = TUSB_REQ_RCPT_DEVICE,
+                .type = TUSB_REQ_TYPE_STANDARD,
+                .direction = TUSB_DIR_OUT
+            },
+            .bRequest = TUSB_REQ_SET_FEATURE,
+            .wValue = TUSB_REQ_FEATURE_REMOTE_WAKEUP,
+            .wIndex = 0,
+            .wLength = 0
+        };
+
+        tuh_xfer_t xfer = {
+            .daddr = power_arm_addr,
+            .ep_addr = 0,
+            .setup = &request,
+            .buffer = NULL,
+            .complete_cb = power_arm_complete,
+            .user_data = 0
+        };
+
+        // Control pipe busy, try again on the next call
+        if (tuh_control_xfer(&xfer)) power_arm_pending = true;
+        return false;
+    }
+
+    return true;
+}
+
+static void power_suspend(void) {
+    power_wake = false;
+    power_wake_irq_enable(true);
+#if CFG_TUH_RPI_HYBRID_USB
+    hcd_hybrid_suspend();
+#endif
+    power_state = POWER_SUSPENDED;
+    printf("PWR: suspended\n");
+}
+
+static void power_resume(void) {
+    power_wake_irq_enable(false);
+#if CFG_TUH_RPI_HYBRID_USB
+    hcd_hybrid_resume();
+#endif
+    power_resume_us = time_us_32();
+    power_state = POWER_WAKING;
+}
+
+bool power_is_suspended(void) {
+    return power_state == POWER_SUSPENDED || power_state == POWER_WAKING ||
+           power_state == POWER_RESUMING;
+}
+
+void power_task(void) {
+    u32 now = time_us_32();
+    bool idle = power_hosts_idle(now);
+
+    if (!idle) power_busy_us = now;
+
+    switch (power_state) {
+        case POWER_ACTIVE:
+            // A SET_FEATURE left over from an abandoned pass still moves
+            // power_arm_addr on completion, so wait for it first
+            if (idle && now - power_busy_us > POWER_IDLE_US && !power_arm_pending) {
+                power_arm_addr = 1;
+                power_state = POWER_ARMING;
+            }
+            break;
+
+        case POWER_ARMING:
+            if (!idle) {
+                // Let an in-flight SET_FEATURE finish on its own
+                power_state = POWER_ACTIVE;
+            } else if (power_arm_devices()) {
+                power_suspend();
+            }
+            break;
+
+        case POWER_SUSPENDED: {
+            bool usb_wake = false;
+#if CFG_TUH_RPI_HYBRID_USB
+            usb_wake = hcd_hybrid_wakeup_pending();
+#endif
+            if (!idle || usb_wake) {
+                power_resume();
+                break;
+            }
+
+            // Sleep until a wake edge or any other interrupt; the flag is
+            // re-checked with interrupts off so an edge cannot be missed
+            u32 save = save_and_disable_interrupts();
+            if (!power_wake) __wfi();
+            restore_interrupts(save);
+            power_wake = false;
+            break;
+        }
+
+        case POWER_WAKING: {
+            u32 signal_us = 0;
+#if CFG_TUH_RPI_HYBRID_USB
+            signal_us = HCD_HYBRID_RESUME_US;
+#endif
+            if (now - power_resume_us > signal_us) {
+#if CFG_TUH_RPI_HYBRID_USB
+                hcd_hybrid_resume_end();
+#endif
+                power_resume_us = now;
+                power_state = POWER_RESUMING;
+            }
+            break;
+        }
+
+        case POWER_RESUMING:
+            if (now - power_resume_us > POWER_RESUME_US) {
+                power_state = POWER_ACTIVE;
+                power_busy_us = now;
+                printf("PWR: resumed\n");
+            }
+            break;
+    }
+}
+
+void power_init(void) {
+    u32 now = time_us_32();
+    u32 mask = 0;
+
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        power_kb_clk_high_us[i] = now;
+        power_ms_clk_high_us[i] = now;
+        mask |= (1u << power_kb_clk_pins[i]) | (1u << power_ms_clk_pins[i]);
+    }
+    power_busy_us = now;
+
+    gpio_add_raw_irq_handler_masked(mask, power_gpio_irq);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
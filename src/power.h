@@ -0,0 +1,24 @@
+/*
+ * Hecate - Power Management
+ *
+ * Public interface for the idle/suspend state machine.
+ * Suspends USB devices and sleeps the core while no PS/2 host listens.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+
+// Initialize power management (after PS/2 and USB init)
+void power_init(void);
+
+// Run the power state machine (call last in main loop, may sleep)
+void power_task(void);
+
+// Check if USB devices are currently suspended
+bool power_is_suspended(void);
+
+#endif // POWER_H
@@ -2,53 +2,69 @@
  * Hecate - PS/2 Keyboard Emulation Driver
  *
  * This driver emulates a PS/2 keyboard, translating USB HID keycodes
- * to PS/2 Scancode Set 2 and handling bidirectional communication
- * with the PS/2 host.
+ * to PS/2 scancodes and handling bidirectional communication with the
+ * PS/2 host.
  *
  * Features:
- *   - Full Scancode Set 2 support
- *   - Key repeat (typematic) with configurable rate and delay
+ *   - Scancode Sets 1, 2 and 3, selected by the host at runtime (F0)
+ *   - Set 3 per-key types (typematic, make/break, make only; F7-FD)
+ *   - Key repeat (typematic) with configurable rate and delay, on a
+ *     timer wheel deadline with absolute targets; repeats are skipped,
+ *     never queued, while the port is backlogged
  *   - LED feedback (Caps Lock, Num Lock, Scroll Lock)
  *   - Host command handling (Reset, Echo, Identify, Set LEDs, etc.)
  *   - Special key sequences (Pause/Break, Print Screen)
  *   - Extended key support (E0 prefix)
+ *   - Make/break/repeat sequences precomputed per set at build time
+ *     (tools/gen_scancodes.py)
+ *   - All transitions of one USB report queued as a single batch
+ *   - Command responses bypass queued scancodes; key breaks are never
+ *     dropped on overflow (retried until they fit)
  *
  * SPDX-License-Identifier: MIT
  */
 
 #include "ps2_keyboard.h"
+#include "ps2_scancodes.h"
 #include "tusb.h"
-
-static ps2out kb_out;
-
-static bool kb_enabled = true;
-static u8 kb_modifiers = 0;
-static u8 kb_repeat_key = 0;
-static u16 kb_delay_ms = 500;
-static u32 kb_repeat_us = 91743;
-static alarm_id_t kb_repeater = 0;
-
-// LED state for USB keyboard sync
-u8 kb_set_led = 0;
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include <stdio.h>
+#include <string.h>
+
+// Per-host keyboard state. Each PS/2 host keeps its own typematic, LED
+// and enable state; USB key events go to the selected host only.
+typedef struct {
+    ps2out out;
+    bool enabled;
+    volatile bool bat_sent;     // BAT stop bit went out (set in the PIO IRQ)
+    u8 modifiers;
+    volatile u8 repeat_key;     // Key being repeated, 0 = none
+    u16 delay_ms;
+    u32 repeat_us;
+    u64 repeat_at;              // Absolute target of the next repeat
+    u64 repeat_last;            // When the previous repeat went out, 0 = none
+    tw_timer reset_timer;       // BAT after a host reset
+    u8 leds;                    // LED state as last set by this host
+    u32 down[8];                // Keys made on this host, by HID keycode
+    u32 breaks_pending[8];      // Break codes that did not fit, by HID keycode
+    bool breaks_any;
+    u8 set;                     // Scancode set 1-3
+    u8 attr_cmd;                // FB/FC/FD awaiting its key list, else 0
+    u32 no_repeat[5];           // Set 3 keys without typematic, by set 3 code
+    u32 no_break[5];            // Set 3 keys without break codes, by set 3 code
+} kb_host_t;
+
+static kb_host_t kb_hosts[PS2_HOST_COUNT];
+static kb_host_t* kb_active = &kb_hosts[0];
+
+// Port assignment per host: pio1 SM and DATA pin (CLK = DATA + 1)
+static const u8 kb_sms[2] = { 0, 1 };
+static const u8 kb_data_pins[2] = { PS2_KB_DATA_PIN, PS2_KB1_DATA_PIN };
 
 // PS/2 to LED conversion table
 static const u8 led2ps2[] = { 0, 4, 1, 5, 2, 6, 3, 7 };
 
-// HID modifier to PS/2 scancode mapping (Set 2)
-static const u8 mod2ps2[] = { 0x14, 0x12, 0x11, 0x1f, 0x14, 0x59, 0x11, 0x27 };
-
-// HID keycode to PS/2 scancode mapping (Set 2)
-static const u8 hid2ps2[] = {
-    0x00, 0x00, 0xfc, 0x00, 0x1c, 0x32, 0x21, 0x23, 0x24, 0x2b, 0x34, 0x33, 0x43, 0x3b, 0x42, 0x4b,
-    0x3a, 0x31, 0x44, 0x4d, 0x15, 0x2d, 0x1b, 0x2c, 0x3c, 0x2a, 0x1d, 0x22, 0x35, 0x1a, 0x16, 0x1e,
-    0x26, 0x25, 0x2e, 0x36, 0x3d, 0x3e, 0x46, 0x45, 0x5a, 0x76, 0x66, 0x0d, 0x29, 0x4e, 0x55, 0x54,
-    0x5b, 0x5d, 0x5d, 0x4c, 0x52, 0x0e, 0x41, 0x49, 0x4a, 0x58, 0x05, 0x06, 0x04, 0x0c, 0x03, 0x0b,
-    0x83, 0x0a, 0x01, 0x09, 0x78, 0x07, 0x7c, 0x7e, 0x7e, 0x70, 0x6c, 0x7d, 0x71, 0x69, 0x7a, 0x74,
-    0x6b, 0x72, 0x75, 0x77, 0x4a, 0x7c, 0x7b, 0x79, 0x5a, 0x69, 0x72, 0x7a, 0x6b, 0x73, 0x74, 0x6c,
-    0x75, 0x7d, 0x70, 0x71, 0x61, 0x2f, 0x37, 0x0f, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38, 0x40,
-    0x48, 0x50, 0x57, 0x5f
-};
-
 // Typematic repeat rates (microseconds between repeats)
 static const u32 kb_repeats[] = {
     33333, 37453, 41667, 45872, 48309, 54054, 58480, 62500,
@@ -60,91 +76,207 @@ static const u32 kb_repeats[] = {
 // Typematic delays (milliseconds before first repeat)
 static const u16 kb_delays[] = { 250, 500, 750, 1000 };
 
-static s64 kb_led_callback(alarm_id_t id, void *user_data);
-
-static void kb_set_leds_internal(u8 byte) {
+static void kb_set_leds_internal(kb_host_t* host, u8 byte) {
     if (byte > 7) byte = 0;
-    kb_set_led = led2ps2[byte];
-    add_alarm_in_us(1000, kb_led_callback, NULL, false);
+    host->leds = led2ps2[byte];
 }
 
-static s64 kb_reset_callback(alarm_id_t id, void *user_data) {
-    (void)id;
-    (void)user_data;
-    kb_set_leds_internal(0);
-    kb_out.packet[1] = 0xaa;
-    ps2out_send(&kb_out, 1);
-    kb_enabled = true;
+static void kb_set_scancode_set(kb_host_t* host, u8 set) {
+    host->set = set;
+    ps2out_set_overrun_code(&host->out, set == 1 ? 0xff : 0x00);
+}
+
+// Power-on defaults: also restores Set 2 with every key typematic/make/break
+static void kb_defaults(kb_host_t* host) {
+    host->repeat_us = 91743;
+    host->delay_ms = 500;
+    host->attr_cmd = 0;
+    memset(host->no_repeat, 0, sizeof(host->no_repeat));
+    memset(host->no_break, 0, sizeof(host->no_break));
+    kb_set_scancode_set(host, 2);
+}
+
+static u32 kb_reset_callback(void* ctx) {
+    kb_host_t* host = ctx;
+    kb_set_leds_internal(host, 0);
+    ps2out_respond_notify(&host->out, (const u8[]){ 0xaa }, 1);
+    host->enabled = true;
     return 0;
 }
 
+// The BAT record's stop bit is out (a flushed BAT never gets here)
+static void kb_bat_sent(void* ctx) {
+    kb_host_t* host = ctx;
+    host->bat_sent = true;
+}
+
 static bool key_is_modifier(u8 key) {
     return key >= HID_KEY_CONTROL_LEFT && key <= HID_KEY_GUI_RIGHT;
 }
 
-static bool key_is_extended(u8 key) {
-    return key == HID_KEY_PRINT_SCREEN ||
-          (key >= HID_KEY_INSERT && key <= HID_KEY_ARROW_UP) ||
-           key == HID_KEY_KEYPAD_DIVIDE ||
-           key == HID_KEY_KEYPAD_ENTER ||
-           key == HID_KEY_APPLICATION ||
-           key == HID_KEY_POWER ||
-          (key >= HID_KEY_GUI_LEFT && key != HID_KEY_SHIFT_RIGHT);
+static const u8* kb_sequence(kb_host_t* host, u8 key, u8 kind, u8* len);
+static bool kb_bit(const u32* map, u8 key);
+static void kb_bit_set(u32* map, u8 key, bool set);
+
+//--------------------------------------------------------------------
+// Typematic Engine
+//
+// One timer wheel deadline serves every host. Repeats fire on absolute
+// targets (press + delay, then exact multiples of the period), so IRQ
+// latency never accumulates into the rate. A tick that finds the port
+// still busy, e.g. while the host inhibits, is skipped instead of
+// queued, so no burst of repeats follows when the line comes back.
+//--------------------------------------------------------------------
+
+static tw_deadline kb_repeat;
+
+// Repeat statistics, all hosts
+static u32 kb_tm_sent = 0;
+static u32 kb_tm_skipped = 0;
+static u32 kb_tm_late_max = 0;      // Worst alarm latency past the target
+static u32 kb_tm_jitter_max = 0;    // Worst |interval - period| between repeats
+static u64 kb_tm_jitter_sum = 0;
+static u32 kb_tm_intervals = 0;
+
+// Aim the deadline at the earliest pending repeat (interrupts disabled)
+static void kb_typematic_schedule(void) {
+    u64 next = TW_NEVER;
+
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        if (kb_hosts[i].repeat_key && kb_hosts[i].repeat_at < next) next = kb_hosts[i].repeat_at;
+    }
+
+    tw_set(&kb_repeat, next);
 }
 
-static s64 kb_repeat_callback(alarm_id_t id, void *user_data) {
-    (void)id;
-    (void)user_data;
-    
-    if (kb_repeat_key) {
-        if (kb_enabled) {
-            u8 len = 0;
-            if (key_is_extended(kb_repeat_key)) kb_out.packet[++len] = 0xe0;
-
-            if (key_is_modifier(kb_repeat_key)) {
-                kb_out.packet[++len] = mod2ps2[kb_repeat_key - HID_KEY_CONTROL_LEFT];
-            } else {
-                kb_out.packet[++len] = hid2ps2[kb_repeat_key];
+static void kb_typematic_irq(u64 now) {
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        kb_host_t* host = &kb_hosts[i];
+        if (!host->repeat_key || now < host->repeat_at) continue;
+
+        u32 late = now - host->repeat_at;
+        if (late > kb_tm_late_max) kb_tm_late_max = late;
+
+        if (host->enabled && !ps2out_is_busy(&host->out)) {
+            u8 len;
+            const u8* seq = kb_sequence(host, host->repeat_key, KB_SEQ_REPEAT, &len);
+            // A repeat's latency counts from the slot it was due in
+            ps2out_send_timed(&host->out, seq, len, false, (u32)host->repeat_at);
+            kb_tm_sent++;
+
+            if (host->repeat_last) {
+                u32 interval = now - host->repeat_last;
+                u32 jitter = interval > host->repeat_us ? interval - host->repeat_us
+                                                        : host->repeat_us - interval;
+                if (jitter > kb_tm_jitter_max) kb_tm_jitter_max = jitter;
+                kb_tm_jitter_sum += jitter;
+                kb_tm_intervals++;
             }
-
-            ps2out_send(&kb_out, len);
+            host->repeat_last = now;
+        } else {
+            kb_tm_skipped++;
+            host->repeat_last = 0;
         }
 
-        return kb_repeat_us;
+        // Next slot on the grid; slots already missed are dropped
+        do {
+            host->repeat_at += host->repeat_us;
+        } while (host->repeat_at <= now);
     }
 
-    kb_repeater = 0;
-    return 0;
+    kb_typematic_schedule();
 }
 
-static void kb_receive(u8 byte, u8 prev_byte) {
+static void kb_typematic_start(kb_host_t* host, u8 key) {
+    u32 status = save_and_disable_interrupts();
+    host->repeat_key = key;
+    host->repeat_at = time_us_64() + host->delay_ms * 1000u;
+    host->repeat_last = 0;
+    kb_typematic_schedule();
+    restore_interrupts(status);
+}
+
+static void kb_typematic_stop(kb_host_t* host) {
+    u32 status = save_and_disable_interrupts();
+    host->repeat_key = 0;
+    kb_typematic_schedule();
+    restore_interrupts(status);
+}
+
+void ps2_keyboard_print_stats(void) {
+    printf("Typematic: %lu sent, %lu skipped, worst late %lu us, "
+           "interval jitter max %lu us avg %lu us\n",
+           (unsigned long)kb_tm_sent, (unsigned long)kb_tm_skipped,
+           (unsigned long)kb_tm_late_max, (unsigned long)kb_tm_jitter_max,
+           (unsigned long)(kb_tm_intervals ? kb_tm_jitter_sum / kb_tm_intervals : 0));
+}
+
+void ps2_keyboard_reset_stats(void) {
+    u32 status = save_and_disable_interrupts();
+    kb_tm_sent = 0;
+    kb_tm_skipped = 0;
+    kb_tm_late_max = 0;
+    kb_tm_jitter_max = 0;
+    kb_tm_jitter_sum = 0;
+    kb_tm_intervals = 0;
+    restore_interrupts(status);
+}
+
+// Host command handler, called from the PIO interrupt
+static void kb_receive(void* ctx, u8 byte, u8 prev_byte) {
+    kb_host_t* host = ctx;
+
+    // Set 3 key list after FB/FC/FD, ended by the next command
+    if (host->attr_cmd && byte < 0xed) {
+        if (byte < 0xa0) {
+            kb_bit_set(host->no_repeat, byte, host->attr_cmd != 0xfb);
+            kb_bit_set(host->no_break, byte, host->attr_cmd != 0xfc);
+        }
+        ps2out_respond(&host->out, (const u8[]){ 0xfa }, 1);
+        return;
+    }
+    host->attr_cmd = 0;
+
     switch (prev_byte) {
         case 0xed: // Set LEDs
-            kb_set_leds_internal(byte);
+            kb_set_leds_internal(host, byte);
             break;
 
-        case 0xf0: // Set scan code set (we only support set 2)
-            // Just acknowledge, we always use set 2
+        case 0xf0: // Get/set scan code set
+            if (byte == 0) {
+                ps2out_respond(&host->out, (const u8[]){ 0xfa, host->set }, 2);
+                return;
+            }
+            if (byte > 3) {
+                ps2out_respond(&host->out, (const u8[]){ 0xfe }, 1);
+                return;
+            }
+            // Codes already queued belong to the old set
+            ps2out_flush(&host->out);
+            kb_set_scancode_set(host, byte);
             break;
 
         case 0xf3: // Set typematic rate and delay
-            kb_repeat_us = kb_repeats[byte & 0x1f];
-            kb_delay_ms = kb_delays[(byte & 0x60) >> 5];
+            host->repeat_us = kb_repeats[byte & 0x1f];
+            host->delay_ms = kb_delays[(byte & 0x60) >> 5];
             break;
 
         default:
             switch (byte) {
                 case 0xff: // Reset
-                    kb_enabled = false;
-                    kb_repeat_us = 91743;
-                    kb_delay_ms = 500;
-                    kb_set_leds_internal(7); // All LEDs on during reset
-                    add_alarm_in_ms(500, kb_reset_callback, NULL, false);
+                    host->enabled = false;
+                    ps2out_flush(&host->out);
+                    memset(host->down, 0, sizeof(host->down));
+                    memset(host->breaks_pending, 0, sizeof(host->breaks_pending));
+                    host->breaks_any = false;
+                    host->modifiers = 0;
+                    kb_defaults(host);
+                    kb_set_leds_internal(host, 7); // All LEDs on during reset
+                    tw_arm(&host->reset_timer, 500000);
                     break;
 
                 case 0xee: // Echo
-                    kb_out.packet[1] = 0xee;
-                    ps2out_send(&kb_out, 1);
+                    ps2out_respond(&host->out, (const u8[]){ 0xee }, 1);
                     return;
 
                 case 0xf0: // Get/Set scan code set
@@ -154,30 +286,44 @@ static void kb_receive(u8 byte, u8 prev_byte) {
                     break;
 
                 case 0xf2: // Identify keyboard
-                    kb_out.packet[1] = 0xfa;
-                    kb_out.packet[2] = 0xab;
-                    kb_out.packet[3] = 0x83;
-                    ps2out_send(&kb_out, 3);
+                    ps2out_respond(&host->out, (const u8[]){ 0xfa, 0xab, 0x83 }, 3);
                     return;
 
-                case 0xf4: // Enable scanning
-                    kb_enabled = true;
+                case 0xf4: // Enable scanning, clear output buffer
+                    host->enabled = true;
+                    ps2out_flush(&host->out);
                     break;
 
                 case 0xf5: // Disable scanning, restore default parameters
-                    kb_enabled = false;
-                    kb_repeat_us = 91743;
-                    kb_delay_ms = 500;
-                    kb_set_leds_internal(0);
+                    host->enabled = false;
+                    ps2out_flush(&host->out);
+                    kb_defaults(host);
+                    kb_set_leds_internal(host, 0);
                     break;
 
                 case 0xf6: // Set default parameters (keep scanning enabled)
-                    kb_repeat_us = 91743;
-                    kb_delay_ms = 500;
-                    kb_set_leds_internal(0);
+                    ps2out_flush(&host->out);
+                    kb_defaults(host);
+                    kb_set_leds_internal(host, 0);
                     // Note: F6 does NOT disable scanning
                     break;
 
+                case 0xf7: // Set all keys typematic (Set 3)
+                case 0xf8: // Set all keys make/break
+                case 0xf9: // Set all keys make only
+                case 0xfa: // Set all keys typematic/make/break
+                    memset(host->no_repeat, byte == 0xf7 || byte == 0xfa ? 0 : 0xff,
+                           sizeof(host->no_repeat));
+                    memset(host->no_break, byte == 0xf8 || byte == 0xfa ? 0 : 0xff,
+                           sizeof(host->no_break));
+                    break;
+
+                case 0xfb: // Set key typematic (Set 3), key list follows
+                case 0xfc: // Set key make/break
+                case 0xfd: // Set key make only
+                    host->attr_cmd = byte;
+                    break;
+
                 default:
                     break;
             }
@@ -185,109 +331,261 @@ static void kb_receive(u8 byte, u8 prev_byte) {
     }
 
     // Send ACK
-    kb_out.packet[1] = 0xfa;
-    ps2out_send(&kb_out, 1);
+    ps2out_respond(&host->out, (const u8[]){ 0xfa }, 1);
 }
 
-void ps2_keyboard_send_key(u8 key, bool state) {
-    // Handle modifiers
-    if (key >= HID_KEY_CONTROL_LEFT && key <= HID_KEY_GUI_RIGHT) {
-        if (state) {
-            kb_modifiers = kb_modifiers | (1 << (key - HID_KEY_CONTROL_LEFT));
+// Precomputed sequence of a key in the host's set; *len is 0 when the key
+// sends nothing (no code in this set, no break/repeat, or Set 3 key type)
+static const u8* kb_sequence(kb_host_t* host, u8 key, u8 kind, u8* len) {
+    u16 seq = kb_seq[host->set - 1][kind][key];
+    *len = seq & 0xf;
+
+    if (host->set == 3 && kind == KB_SEQ_BREAK && kb_bit(host->no_break, kb_set3_codes[key])) {
+        *len = 0;
+    }
+
+    return &kb_seq_pool[seq >> 4];
+}
+
+// Whether a held key repeats in the host's scancode set
+static bool kb_typematic(kb_host_t* host, u8 key) {
+    if (!(kb_seq[host->set - 1][KB_SEQ_REPEAT][key] & 0xf)) return false;
+    return host->set != 3 || !kb_bit(host->no_repeat, kb_set3_codes[key]);
+}
+
+static bool kb_bit(const u32* map, u8 key) {
+    return map[key >> 5] & (1u << (key & 31));
+}
+
+static void kb_bit_set(u32* map, u8 key, bool set) {
+    if (set) {
+        map[key >> 5] |= 1u << (key & 31);
+    } else {
+        map[key >> 5] &= ~(1u << (key & 31));
+    }
+}
+
+// Send a break code; one that does not fit is retried from the task
+static void kb_send_break(kb_host_t* host, u8 key) {
+    u8 len;
+    const u8* seq = kb_sequence(host, key, KB_SEQ_BREAK, &len);
+
+    if (len && !ps2out_send_release(&host->out, seq, len)) {
+        kb_bit_set(host->breaks_pending, key, true);
+        host->breaks_any = true;
+    }
+}
+
+// Queue break codes that were refused earlier, in keycode order
+static void kb_retry_breaks(kb_host_t* host) {
+    bool any = false;
+
+    for (u16 key = 0; key < 256; key++) {
+        if (!kb_bit(host->breaks_pending, key)) continue;
+
+        u8 len;
+        const u8* seq = kb_sequence(host, key, KB_SEQ_BREAK, &len);
+        if (!len || ps2out_send_release(&host->out, seq, len)) {
+            kb_bit_set(host->breaks_pending, key, false);
         } else {
-            kb_modifiers = kb_modifiers & ~(1 << (key - HID_KEY_CONTROL_LEFT));
+            any = true;
         }
-    } else if (key < HID_KEY_A || key > HID_KEY_F24) {
-        return;
     }
 
-    u8 len = 0;
+    host->breaks_any = any;
+}
 
-    if (!kb_enabled) {
-        return;
+// Per-report transmit batch. The transitions of one USB report are
+// collected here and reach ps2out in a single commit, followed by a single
+// typematic update, instead of one queue operation and re-arm per key.
+#define KB_BATCH_RECORDS 32
+#define KB_BATCH_BYTES   128
+
+static struct {
+    kb_host_t* host;            // Host being batched for, NULL outside a batch
+    u8 data[KB_BATCH_BYTES];    // Sequences back to back
+    u8 lens[KB_BATCH_RECORDS];
+    u8 keys[KB_BATCH_RECORDS];
+    u32 release;                // Bit per record: break code
+    u8 count;
+    u8 bytes;
+    u8 repeat_key;              // Key to repeat once the batch is out, 0 = none
+    bool repeat_restart;        // A press in the batch restarts the delay
+    u32 origin;                 // USB transfer time of the report
+} kb_batch;
+
+static void kb_batch_flush(void) {
+    kb_host_t* host = kb_batch.host;
+    if (!kb_batch.count) return;
+
+    u32 refused = ps2out_send_batch(&host->out, kb_batch.data, kb_batch.lens,
+                                    kb_batch.release, kb_batch.count, kb_batch.origin);
+
+    // Refused breaks are retried from the task like any other
+    refused &= kb_batch.release;
+    for (u8 i = 0; refused; i++, refused >>= 1) {
+        if (!(refused & 1)) continue;
+        kb_bit_set(host->breaks_pending, kb_batch.keys[i], true);
+        host->breaks_any = true;
     }
 
-    // Special handling for Pause key
-    if (key == HID_KEY_PAUSE) {
-        kb_repeat_key = 0;
+    kb_batch.count = 0;
+    kb_batch.bytes = 0;
+    kb_batch.release = 0;
+}
 
-        if (state) {
-            if (kb_modifiers & KEYBOARD_MODIFIER_LEFTCTRL ||
-                kb_modifiers & KEYBOARD_MODIFIER_RIGHTCTRL) {
-                // Ctrl+Pause = Break
-                kb_out.packet[++len] = 0xe0;
-                kb_out.packet[++len] = 0x7e;
-                kb_out.packet[++len] = 0xe0;
-                kb_out.packet[++len] = 0xf0;
-                kb_out.packet[++len] = 0x7e;
-            } else {
-                // Pause sequence
-                kb_out.packet[++len] = 0xe1;
-                kb_out.packet[++len] = 0x14;
-                kb_out.packet[++len] = 0x77;
-                kb_out.packet[++len] = 0xe1;
-                kb_out.packet[++len] = 0xf0;
-                kb_out.packet[++len] = 0x14;
-                kb_out.packet[++len] = 0xf0;
-                kb_out.packet[++len] = 0x77;
-            }
+static void kb_batch_add(u8 key, const u8* seq, u8 len, bool release) {
+    if (kb_batch.count == KB_BATCH_RECORDS || kb_batch.bytes + len > KB_BATCH_BYTES) {
+        kb_batch_flush();
+    }
+
+    memcpy(&kb_batch.data[kb_batch.bytes], seq, len);
+    kb_batch.lens[kb_batch.count] = len;
+    kb_batch.keys[kb_batch.count] = key;
+    if (release) kb_batch.release |= 1u << kb_batch.count;
+    kb_batch.count++;
+    kb_batch.bytes += len;
+}
+
+void ps2_keyboard_batch_begin(u32 origin_us) {
+    kb_batch.host = kb_active;
+    kb_batch.origin = origin_us;
+    kb_batch.repeat_key = kb_active->repeat_key;
+    kb_batch.repeat_restart = false;
+}
+
+void ps2_keyboard_batch_end(void) {
+    kb_host_t* host = kb_batch.host;
+    if (!host) return;
 
-            ps2out_send(&kb_out, len);
+    kb_batch_flush();
+
+    if (kb_batch.repeat_restart && kb_batch.repeat_key) {
+        kb_typematic_start(host, kb_batch.repeat_key);
+    } else if (!kb_batch.repeat_key && host->repeat_key) {
+        kb_typematic_stop(host);
+    }
+
+    kb_batch.host = NULL;
+}
+
+static void kb_key(kb_host_t* host, u8 key, bool state) {
+    // Handle modifiers
+    if (key_is_modifier(key)) {
+        if (state) {
+            host->modifiers = host->modifiers | (1 << (key - HID_KEY_CONTROL_LEFT));
+        } else {
+            host->modifiers = host->modifiers & ~(1 << (key - HID_KEY_CONTROL_LEFT));
         }
+    } else if (key > HID_KEY_GUI_RIGHT) {
+        return;
+    }
 
+    if (!host->enabled) {
         return;
     }
 
-    // Add E0 prefix for extended keys
-    if (key_is_extended(key)) kb_out.packet[++len] = 0xe0;
+    u8 len;
 
     if (state) {
-        // Key press - set up repeat
-        kb_repeat_key = key;
-        if (kb_repeater) cancel_alarm(kb_repeater);
-        kb_repeater = add_alarm_in_ms(kb_delay_ms, kb_repeat_callback, NULL, false);
+        // Ctrl+Pause is Break, a sequence of its own
+        u8 seq_key = key;
+        if (key == HID_KEY_PAUSE && host->modifiers & (KEYBOARD_MODIFIER_LEFTCTRL |
+                                                         KEYBOARD_MODIFIER_RIGHTCTRL)) {
+            seq_key = KB_SEQ_CTRL_PAUSE;
+        }
+
+        const u8* seq = kb_sequence(host, seq_key, KB_SEQ_MAKE, &len);
+        if (!len) return;
+
+        // Key press - the newest key takes over repeating
+        kb_batch.repeat_key = kb_typematic(host, key) ? key : 0;
+        kb_batch.repeat_restart = true;
+        kb_bit_set(host->breaks_pending, key, false);
+        kb_bit_set(host->down, key, true);
+        kb_batch_add(key, seq, len, false);
     } else {
-        // Key release
-        if (key == kb_repeat_key) kb_repeat_key = 0;
-        kb_out.packet[++len] = 0xf0;
+        // Key release - must reach the host or the key stays down there.
+        // Keys pressed before a host switch were already released.
+        if (key == kb_batch.repeat_key) kb_batch.repeat_key = 0;
+        if (!kb_bit(host->down, key)) return;
+        kb_bit_set(host->down, key, false);
+
+        const u8* seq = kb_sequence(host, key, KB_SEQ_BREAK, &len);
+        if (len) kb_batch_add(key, seq, len, true);
     }
+}
 
-    // Add scancode
-    if (key >= HID_KEY_CONTROL_LEFT && key <= HID_KEY_GUI_RIGHT) {
-        kb_out.packet[++len] = mod2ps2[key - HID_KEY_CONTROL_LEFT];
-    } else {
-        kb_out.packet[++len] = hid2ps2[key];
+void ps2_keyboard_send_key(u8 key, bool state) {
+    // Outside a report batch every key is a batch of its own
+    if (kb_batch.host) {
+        kb_key(kb_batch.host, key, state);
+        return;
     }
 
-    ps2out_send(&kb_out, len);
+    ps2_keyboard_batch_begin(time_us_32());
+    kb_key(kb_batch.host, key, state);
+    ps2_keyboard_batch_end();
 }
 
-void ps2_keyboard_set_leds(u8 leds) {
-    kb_set_led = leds;
+void ps2_keyboard_select_host(u8 index) {
+    if (index >= PS2_HOST_COUNT || &kb_hosts[index] == kb_active) return;
+
+    // A switch in the middle of a report: the old host gets its part first
+    bool batching = kb_batch.host != NULL;
+    if (batching) ps2_keyboard_batch_end();
+
+    // Release everything held on the old host so nothing stays down there
+    kb_host_t* old = kb_active;
+    kb_typematic_stop(old);
+    old->modifiers = 0;
+    for (u16 key = 0; key < 256; key++) {
+        if (!kb_bit(old->down, key)) continue;
+        kb_bit_set(old->down, key, false);
+        if (old->enabled) kb_send_break(old, key);
+    }
+
+    kb_active = &kb_hosts[index];
+
+    if (batching) ps2_keyboard_batch_begin(kb_batch.origin);
 }
 
-static s64 kb_led_callback(alarm_id_t id, void *user_data) {
-    (void)id;
-    (void)user_data;
-    // This callback is for internal LED timing
-    return 0;
+u8 ps2_keyboard_leds(void) {
+    return kb_active->leds;
 }
 
-s64 ps2_keyboard_led_callback(void) {
-    // This would be called to sync LEDs with USB keyboards
-    // Implementation depends on how USB LED output reports are handled
-    return 0;
+bool ps2_keyboard_bat_sent(u8 index) {
+    return kb_hosts[index].bat_sent;
+}
+
+bool ps2_keyboard_ready(u8 index) {
+    return kb_hosts[index].bat_sent && kb_hosts[index].enabled;
 }
 
 bool ps2_keyboard_task(void) {
-    ps2out_task(&kb_out);
-    return kb_enabled && !ps2out_is_busy();
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        kb_host_t* host = &kb_hosts[i];
+
+        if (host->breaks_any) kb_retry_breaks(host);
+    }
+
+    return kb_active->enabled && !ps2out_is_busy(&kb_active->out);
 }
 
 void ps2_keyboard_init(void) {
-    // Use state machines 0 (TX) and 1 (RX) for keyboard
-    ps2out_init(&kb_out, 0, PS2_KB_DATA_PIN, &kb_receive);
-    
-    // Send self-test passed
-    add_alarm_in_ms(500, kb_reset_callback, NULL, false);
+    tw_deadline_init(&kb_repeat, kb_typematic_irq);
+
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        kb_host_t* host = &kb_hosts[i];
+
+        ps2out_init(&host->out, kb_sms[i], kb_data_pins[i], &kb_receive, host);
+        ps2out_set_sent_callback(&host->out, kb_bat_sent);
+        tw_timer_init(&host->reset_timer, kb_reset_callback, host);
+        kb_defaults(host);
+        ps2out_set_bit_rate(&host->out, PS2_KB_BIT_RATE);
+
+        // Send self-test passed right away so hosts probing early in POST
+        // see a keyboard; the byte goes out once the host releases the lines
+        kb_reset_callback(host);
+    }
 }
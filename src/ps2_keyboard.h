@@ -16,17 +16,45 @@
 #define PS2_KB_DATA_PIN  11
 #define PS2_KB_CLK_PIN   12
 
+// Second host's keyboard (PS2_MULTI_HOST builds)
+#define PS2_KB1_DATA_PIN 6
+#define PS2_KB1_CLK_PIN  7
+
+// Device-to-host bit rate in Hz (11600-16000)
+#ifndef PS2_KB_BIT_RATE
+#define PS2_KB_BIT_RATE  PS2OUT_BIT_RATE_DEFAULT
+#endif
+
 // Initialize PS/2 keyboard emulation
 void ps2_keyboard_init(void);
 
-// Send a key event (handles make/break codes)
+// Send a key event to the selected host (handles make/break codes)
 void ps2_keyboard_send_key(u8 hid_key, bool pressed);
 
-// Set keyboard LEDs (called from USB callback)
-void ps2_keyboard_set_leds(u8 leds);
+// Group the key events of one USB report: everything sent between begin
+// and end is queued to the host in one commit with one typematic update.
+// origin_us is the report's transfer-complete time (time_us_32()).
+void ps2_keyboard_batch_begin(u32 origin_us);
+void ps2_keyboard_batch_end(void);
+
+// Route key events to another host (0..PS2_HOST_COUNT-1). Keys still held
+// on the previous host are released there first.
+void ps2_keyboard_select_host(u8 index);
+
+// LED state the selected host last set, as a USB HID LED output report
+// byte (bit 0 Num Lock, 1 Caps Lock, 2 Scroll Lock)
+u8 ps2_keyboard_leds(void);
+
+// Check if a host's BAT (0xAA) went out on the wire; a BAT flushed by
+// a command or port restart does not count
+bool ps2_keyboard_bat_sent(u8 index);
+
+// Check if a key event would be delivered to a host right now
+bool ps2_keyboard_ready(u8 index);
 
-// Get current LED callback for USB LED sync
-s64 ps2_keyboard_led_callback(void);
+// Print / clear typematic repeat statistics (sent, skipped, jitter)
+void ps2_keyboard_print_stats(void);
+void ps2_keyboard_reset_stats(void);
 
 // Process keyboard tasks (call in main loop)
 bool ps2_keyboard_task(void);
@@ -9,318 +9,556 @@
  *   - IntelliMouse extensions (scroll wheel)
  *   - IntelliMouse Explorer (5-button + wheel)
  *   - Automatic protocol detection via magic sequence
- *   - Configurable sample rate (host-controlled)
- *   - Movement accumulation and overflow handling
+ *   - Configurable sample rate (host-controlled), packets sent on an
+ *     absolute sample grid so the rate never drifts, timed by a timer
+ *     wheel deadline so slots are not quantised to wheel ticks
+ *   - Packets formed just in time, when the line is free for them, on a
+ *     sample grid phase locked to USB reports at the same rate
+ *   - Resolution (E8) and 2:1 scaling (E6/E7), in Q8 fixed point with the
+ *     sub-count remainder carried per axis
+ *   - Movement accumulation; counts beyond the 9-bit packet range carry
+ *     over to the next packet
+ *   - One packetizer for stream and remote mode, fed from an accumulator
+ *     the USB side only touches with interrupts masked
+ *   - Command responses bypass queued movement; button changes are never
+ *     dropped on overflow
  *
  * SPDX-License-Identifier: MIT
  */
 
 #include "ps2_mouse.h"
+#include "sample_clock.h"
 #include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
 #include <stdio.h>
-
-static ps2out ms_out;
+#include <string.h>
 
 #define MS_RATE_DEFAULT 100
-
-static bool ms_streaming = false;
-static bool ms_remote = false;           // Remote mode (send on 0xEB only)
-static bool ms_ismoving = false;
-static bool ms_buttons_changed = false;  // Track button state changes
-static u32 ms_magic_seq = 0;
-static u8 ms_type = 0;      // 0=standard, 3=IntelliMouse, 4=IntelliMouse Explorer
-static u8 ms_rate = MS_RATE_DEFAULT;
-static u8 ms_db = 0;        // button state
-static u8 ms_db_prev = 0;   // previous button state for change detection
-static s16 ms_dx = 0;       // accumulated X movement
-static s16 ms_dy = 0;       // accumulated Y movement
-static s8 ms_dz = 0;        // accumulated wheel movement
-
-static void ms_reset(void) {
-    ms_ismoving = false;
-    ms_buttons_changed = false;
-    ms_db = 0;
-    ms_db_prev = 0;
-    ms_dx = 0;
-    ms_dy = 0;
-    ms_dz = 0;
+#define MS_RES_DEFAULT  2       // 4 counts/mm
+
+// Target time from a USB report's arrival to the sample slot that sends it
+#define MS_PHASE_LEAD_US 500
+
+// Per-host mouse state. Each PS/2 host keeps its own mode, sample rate and
+// mouse type; USB movement goes to the selected host only.
+typedef struct {
+    ps2out out;
+    bool streaming;
+    bool remote;            // Remote mode (send on 0xEB only)
+    bool ismoving;
+    bool buttons_changed;   // Track button state changes
+    volatile bool bat_sent; // BAT stop bit went out (set in the PIO IRQ)
+    volatile bool bat_log;  // BAT queued from the wheel IRQ, printed by the task
+    u8 bat_log_type;        // Device type the BAT carried
+    u32 magic_seq;
+    u8 type;                // 0=standard, 3=IntelliMouse, 4=IntelliMouse Explorer
+    u8 rate;
+    u8 resolution;          // 0-3: 1, 2, 4, 8 counts/mm
+    bool scaling;           // 2:1 scaling (stream mode only)
+    u8 db;                  // button state
+    u8 db_prev;             // previous button state for change detection
+    s16 dx;                 // accumulated X movement
+    s16 dy;                 // accumulated Y movement
+    s8 dz;                  // accumulated wheel movement
+    u8 fx;                  // X counts below one, Q8, after resolution
+    u8 fy;                  // Y counts below one, Q8
+    u32 origin;             // USB time of the oldest report not yet sent
+    bool has_origin;
+    tw_timer reset_timer;   // BAT after a host reset
+    bool sampling;          // Stream mode sample clock running
+    sample_clock clock;     // Next sample slot
+    u64 sample_last;        // Time of the last packet sent, 0 after a gap
+    u32 report_last;        // Arrival of the newest USB report
+    u32 report_interval;    // Between the last two USB reports
+} ms_host_t;
+
+// A packet as built from the accumulators
+typedef struct {
+    u8 data[4];
+    u8 len;
+    bool buttons;           // Carries a button change: must not be dropped
+    u32 origin;             // USB time of the oldest report it carries
+    bool aged;              // Carries report data (origin is a report's)
+} ms_packet;
+
+static ms_host_t ms_hosts[PS2_HOST_COUNT];
+static ms_host_t* ms_active = &ms_hosts[0];
+
+// Port assignment per host: pio1 SM and DATA pin (CLK = DATA + 1)
+static const u8 ms_sms[2] = { 2, 3 };
+static const u8 ms_data_pins[2] = { PS2_MOUSE_DATA_PIN, PS2_MOUSE1_DATA_PIN };
+
+// One timer wheel deadline serves the sample clocks of every host
+static tw_deadline ms_sample;
+
+// Sample clock statistics
+static u32 ms_st_sent = 0;
+static u32 ms_st_skipped = 0;          // Slots lost to a busy line
+static u32 ms_st_late_max = 0;         // Worst sample latency past its slot
+static u32 ms_st_jitter_max = 0;       // Worst |interval - period| between packets
+static u64 ms_st_jitter_sum = 0;
+static u32 ms_st_intervals = 0;
+static u32 ms_st_age_max = 0;          // Worst report age when its packet formed
+static u64 ms_st_age_sum = 0;
+static u32 ms_st_aged = 0;
+
+static void ms_reset(ms_host_t* host) {
+    host->ismoving = false;
+    host->buttons_changed = false;
+    host->db = 0;
+    host->db_prev = 0;
+    host->dx = 0;
+    host->dy = 0;
+    host->dz = 0;
+    host->fx = 0;
+    host->fy = 0;
+    host->has_origin = false;
 }
 
-static s64 ms_reset_callback(alarm_id_t id, void *user_data) {
-    (void)id;
-    (void)user_data;
-    printf("MS: Sending BAT 0xAA, type=%d\n", ms_type);
-    ms_out.packet[1] = 0xaa;
-    ms_out.packet[2] = ms_type;
-    ps2out_send(&ms_out, 2);
+static u32 ms_reset_callback(void* ctx) {
+    ms_host_t* host = ctx;
+    ps2out_respond_notify(&host->out, (const u8[]){ 0xaa, host->type }, 2);
+
+    // Timer wheel IRQ: no printf here, ps2_mouse_task() reports it
+    host->bat_log_type = host->type;
+    host->bat_log = true;
     return 0;
 }
 
-static u8 ms_clamp_xyz(s16 xyz) {
-    if (xyz < -255) return 1;
-    if (xyz > 255) return 255;
-    return xyz;
+// The BAT record's stop bit is out (a flushed BAT never gets here)
+static void ms_bat_sent(void* ctx) {
+    ms_host_t* host = ctx;
+    host->bat_sent = true;
 }
 
-static s16 ms_remain_xyz(s16 xyz) {
-    if (xyz < -255) return xyz + 255;
-    if (xyz > 255) return xyz - 255;
-    return 0;
+// USB counts at the host's resolution. Resolution 2 (4 counts/mm, the
+// reset default) passes them through, each step doubles or halves. Q8
+// fixed point; the fraction carries over, so slow movement at a low
+// resolution is not lost.
+static s32 ms_resolve(ms_host_t* host, u8* frac, s8 counts) {
+    s32 q8 = (s32)counts * (64 << host->resolution) + *frac;
+    *frac = q8 & 0xff;
+    return q8 >> 8;
+}
+
+static s16 ms_saturate(s32 v) {
+    if (v < -INT16_MAX) return -INT16_MAX;
+    if (v > INT16_MAX) return INT16_MAX;
+    return v;
 }
 
-// Build and send a movement packet immediately (for Remote Mode 0xEB response)
-static void ms_send_packet_now(void) {
-    u8 byte1 = 0x08 | (ms_db & 0x07);
-    u8 byte2 = ms_clamp_xyz(ms_dx);
-    u8 byte3 = 0x100 - ms_clamp_xyz(ms_dy);
-    s8 byte4 = 0x100 - ms_dz;
+// 2:1 scaling curve for 0-5 counts; 6 and up are doubled
+static const u8 ms_scale21[6] = { 0, 1, 1, 3, 6, 9 };
+
+// Take one packet's worth of an axis (PS/2 orientation when flip) out of
+// its accumulator: the 9-bit range -256..255, or with 2:1 scaling what
+// the curve maps into it. The rest stays for the next packet.
+static s16 ms_take_axis(s16* acc, bool flip, bool scale) {
+    s16 v = flip ? -*acc : *acc;
+    s16 lo = scale ? -128 : -256;
+    s16 hi = scale ? 127 : 255;
+
+    if (v < lo) v = lo;
+    if (v > hi) v = hi;
+    *acc -= flip ? -v : v;
+
+    if (!scale) return v;
+    u16 mag = v < 0 ? -v : v;
+    s16 out = mag < 6 ? ms_scale21[mag] : mag * 2;
+    return v < 0 ? -out : out;
+}
 
-    if (ms_dx < 0) byte1 |= 0x10;
-    if (ms_dy > 0) byte1 |= 0x20;
+// The one packet builder, for stream and remote mode. Runs in interrupt
+// context (the port's provider call, or the host's 0xEB), where it
+// cannot be preempted by the other; ps2_mouse_send_movement() adds to
+// the accumulators with interrupts masked. So the snapshot taken here is
+// consistent, and what the packet carries is consumed in the same step.
+// 2:1 scaling only applies to stream mode.
+static void ms_packetize(ms_host_t* host, ms_packet* p, bool stream) {
+    bool scale = stream && host->scaling;
+    s16 x = ms_take_axis(&host->dx, false, scale);
+    s16 y = ms_take_axis(&host->dy, true, scale);
+
+    u8 byte1 = 0x08 | (host->db & 0x07);
+    u8 byte2 = x;
+    u8 byte3 = y;
+    s8 byte4 = 0x100 - host->dz;
+
+    if (x < 0) byte1 |= 0x10;
+    if (y < 0) byte1 |= 0x20;
     if (byte2 == 0xaa) byte2 = 0xab;
     if (byte3 == 0xaa) byte3 = 0xab;
 
     u8 len = 0;
-    ms_out.packet[++len] = byte1;
-    ms_out.packet[++len] = byte2;
-    ms_out.packet[++len] = byte3;
+    p->data[len++] = byte1;
+    p->data[len++] = byte2;
+    p->data[len++] = byte3;
 
-    if (ms_type == 3 || ms_type == 4) {
+    if (host->type == 3 || host->type == 4) {
         if (byte4 < -8) byte4 = -8;
         if (byte4 > 7) byte4 = 7;
 
-        if (ms_type == 4) {
+        if (host->type == 4) {
             byte4 &= 0x0f;
-            byte4 |= (ms_db << 1) & 0x30;
+            byte4 |= (host->db << 1) & 0x30;
         }
 
-        ms_out.packet[++len] = byte4;
+        p->data[len++] = byte4;
     }
+    p->len = len;
+
+    host->dz = 0;
+
+    p->buttons = host->buttons_changed;
+    host->buttons_changed = false;
+
+    // Latency counts from the oldest report this packet carries; movement
+    // left over past the clamp keeps that origin for the next packet
+    p->aged = host->has_origin;
+    p->origin = host->has_origin ? host->origin : time_us_32();
+    host->has_origin = host->has_origin && (host->dx || host->dy);
+}
 
-    ms_dx = ms_remain_xyz(ms_dx);
-    ms_dy = ms_remain_xyz(ms_dy);
-    ms_dz = 0;
-    ms_buttons_changed = false;
-    ps2out_send(&ms_out, len);
+// Whether a stream sample will have anything to report
+static bool ms_stream_pending(ms_host_t* host) {
+    return host->dx || host->dy || host->dz || host->db || host->buttons_changed ||
+           host->ismoving;
 }
 
-static s64 ms_send_callback(alarm_id_t id, void *user_data) {
-    (void)id;
-    (void)user_data;
+// Whether a stream sample has anything to report: movement, buttons,
+// or the all-zero packet that ends a movement
+static bool ms_stream_due(ms_host_t* host) {
+    if (host->dx || host->dy || host->dz || host->db || host->buttons_changed) {
+        host->ismoving = true;
+        return true;
+    }
+    if (!host->ismoving) return false;
+    host->ismoving = false;
+    return true;
+}
 
-    if (!ms_streaming) return 0;
-    if (ps2out_is_busy()) return 1000000 / ms_rate;
+static u32 ms_period_us(ms_host_t* host) {
+    return 1000000 / (host->rate ? host->rate : MS_RATE_DEFAULT);
+}
 
-    // Always send when buttons changed, even if no movement
-    bool has_data = ms_dx || ms_dy || ms_dz || ms_db || ms_buttons_changed;
+// Aim the deadline at the earliest sample slot (interrupts disabled)
+static void ms_sample_schedule(void) {
+    u64 next = TW_NEVER;
 
-    if (!has_data) {
-        if (!ms_ismoving) return 1000000 / ms_rate;
-        ms_ismoving = false;
-    } else {
-        ms_ismoving = true;
-        ms_buttons_changed = false;  // Clear flag after we commit to send
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        if (ms_hosts[i].sampling && ms_hosts[i].clock.at < next) next = ms_hosts[i].clock.at;
     }
 
-    u8 byte1 = 0x08 | (ms_db & 0x07);
-    u8 byte2 = ms_clamp_xyz(ms_dx);
-    u8 byte3 = 0x100 - ms_clamp_xyz(ms_dy);
-    s8 byte4 = 0x100 - ms_dz;
+    tw_set(&ms_sample, next);
+}
 
-    if (ms_dx < 0) byte1 |= 0x10;
-    if (ms_dy > 0) byte1 |= 0x20;
-    if (byte2 == 0xaa) byte2 = 0xab;
-    if (byte3 == 0xaa) byte3 = 0xab;
+// Start the sample clock after delay_us; restarting never stacks a second one
+static void ms_sample_start(ms_host_t* host, u32 delay_us) {
+    u32 status = save_and_disable_interrupts();
+    sample_clock_start(&host->clock, time_us_64() + delay_us);
+    host->sample_last = 0;
+    host->sampling = true;
+    ms_sample_schedule();
+    restore_interrupts(status);
+}
 
-    u8 len = 0;
-    ms_out.packet[++len] = byte1;
-    ms_out.packet[++len] = byte2;
-    ms_out.packet[++len] = byte3;
+// Sample slot: ask the port for a packet. It is formed by ms_provide()
+// once the line is free, not here, so it carries the latest movement.
+static void ms_sample_slot(ms_host_t* host, u64 now) {
+    u8 rate = host->rate ? host->rate : MS_RATE_DEFAULT;
 
-    if (ms_type == 3 || ms_type == 4) {
-        if (byte4 < -8) byte4 = -8;
-        if (byte4 > 7) byte4 = 7;
+    if (!host->streaming) {
+        host->sampling = false;
+        return;
+    }
 
-        if (ms_type == 4) {
-            byte4 &= 0x0f;
-            byte4 |= (ms_db << 1) & 0x30;
-        }
+    u32 late = now - host->clock.at;
+    if (late > ms_st_late_max) ms_st_late_max = late;
+
+    // Pull the grid towards MS_PHASE_LEAD_US after the USB report each
+    // slot will carry, then advance to the next slot
+    sample_clock_lock(&host->clock, rate, host->report_last, host->report_interval,
+                      MS_PHASE_LEAD_US);
+    sample_clock_next(&host->clock, rate, now);
+
+    // The last slot's packet is still waiting for the line: keep
+    // accumulating, that one request will carry it all
+    if (ps2out_requested(&host->out)) {
+        ms_st_skipped++;
+        host->sample_last = 0;
+        return;
+    }
+
+    if (ms_stream_pending(host)) {
+        ps2out_request(&host->out);
+    } else {
+        host->sample_last = 0;
+    }
+}
+
+static void ms_sample_irq(u64 now) {
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        ms_host_t* host = &ms_hosts[i];
+        if (host->sampling && now >= host->clock.at) ms_sample_slot(host, now);
+    }
+
+    ms_sample_schedule();
+}
+
+// Provider for the port: latch the accumulators right before the first
+// byte goes out. The line is idle here, so the packet always fits.
+static u8 ms_provide(void* ctx, u8* data, bool* release, u32* origin_us) {
+    ms_host_t* host = ctx;
 
-        ms_out.packet[++len] = byte4;
+    if (!host->streaming || !ms_stream_due(host)) {
+        host->sample_last = 0;
+        return 0;
     }
 
-    ms_dx = ms_remain_xyz(ms_dx);
-    ms_dy = ms_remain_xyz(ms_dy);
-    ms_dz = 0;
-    ps2out_send(&ms_out, len);
+    ms_packet p;
+    ms_packetize(host, &p, true);
+    memcpy(data, p.data, p.len);
+    *release = p.buttons;
+    *origin_us = p.origin;
+    ms_st_sent++;
+
+    u64 now = time_us_64();
+    if (p.aged) {
+        u32 age = (u32)now - p.origin;
+        if (age > ms_st_age_max) ms_st_age_max = age;
+        ms_st_age_sum += age;
+        ms_st_aged++;
+    }
+
+    // Interval jitter between packets in back-to-back slots
+    if (host->sample_last) {
+        u32 period = ms_period_us(host);
+        u32 interval = now - host->sample_last;
+        u32 jitter = interval > period ? interval - period : period - interval;
+        if (jitter > ms_st_jitter_max) ms_st_jitter_max = jitter;
+        ms_st_jitter_sum += jitter;
+        ms_st_intervals++;
+    }
+    host->sample_last = now;
 
-    return 1000000 / ms_rate;
+    return p.len;
 }
 
-void ps2_mouse_send_movement(u8 buttons, s8 x, s8 y, s8 wheel) {
+void ps2_mouse_send_movement(u8 buttons, s8 x, s8 y, s8 wheel, u32 origin_us) {
+    ms_host_t* host = ms_active;
+
+    // The packetizer runs from interrupts; keep it from seeing half an update
+    u32 status = save_and_disable_interrupts();
+
+    if (host->report_last) host->report_interval = origin_us - host->report_last;
+    host->report_last = origin_us;
+
+    if (!host->has_origin) {
+        host->origin = origin_us;
+        host->has_origin = true;
+    }
+
     // Track button state changes to ensure clicks aren't lost
     // even when USB reports faster than PS/2 sample rate
-    if (buttons != ms_db_prev) {
-        ms_buttons_changed = true;
-        ms_db_prev = buttons;
+    if (buttons != host->db_prev) {
+        host->buttons_changed = true;
+        host->db_prev = buttons;
     }
-    ms_db = buttons;
-    ms_dx += x;
-    ms_dy += y;
-    ms_dz += wheel;
+    host->db = buttons;
+    host->dx = ms_saturate(host->dx + ms_resolve(host, &host->fx, x));
+    host->dy = ms_saturate(host->dy + ms_resolve(host, &host->fy, y));
+    host->dz += wheel;
+
+    restore_interrupts(status);
 }
 
-static void ms_receive(u8 byte, u8 prev_byte) {
+// Host command handler, called from the PIO interrupt
+static void ms_receive(void* ctx, u8 byte, u8 prev_byte) {
+    ms_host_t* host = ctx;
+
     switch (prev_byte) {
-        case 0xe8: // Set Resolution - data byte (ignored, just ACK)
+        case 0xe8: // Set Resolution - data byte
+            if (byte <= 3) host->resolution = byte;
             break;
 
         case 0xf3: // Set Sample Rate
-            ms_rate = byte;
+            host->rate = byte;
 
-            ms_magic_seq = ((ms_magic_seq << 8) | byte) & 0xffffff;
+            host->magic_seq = ((host->magic_seq << 8) | byte) & 0xffffff;
 
             // IntelliMouse magic sequence detection
-            if (ms_type == 0 && ms_magic_seq == 0xc86450) {
-                ms_type = 3;  // IntelliMouse (3-button + wheel)
-            } else if (ms_type == 3 && ms_magic_seq == 0xc8c850) {
-                ms_type = 4;  // IntelliMouse Explorer (5-button + wheel)
+            if (host->type == 0 && host->magic_seq == 0xc86450) {
+                host->type = 3;  // IntelliMouse (3-button + wheel)
+            } else if (host->type == 3 && host->magic_seq == 0xc8c850) {
+                host->type = 4;  // IntelliMouse Explorer (5-button + wheel)
             }
 
-            ms_reset();
+            ms_reset(host);
             break;
 
         default:
             switch (byte) {
                 case 0xff: // Reset
-                    add_alarm_in_ms(100, ms_reset_callback, NULL, false);
-                    ms_type = 0;
+                    tw_arm(&host->reset_timer, 100000);
+                    host->type = 0;
                     // fall through
                 case 0xf6: // Set Defaults
-                    ms_rate = MS_RATE_DEFAULT;
-                    ms_remote = false;
+                    host->rate = MS_RATE_DEFAULT;
+                    host->resolution = MS_RES_DEFAULT;
+                    host->scaling = false;
+                    host->remote = false;
                     // fall through
                 case 0xf5: // Disable Data Reporting
-                    ms_streaming = false;
-                    ms_reset();
+                    host->streaming = false;
+                    ps2out_flush(&host->out);
+                    ms_reset(host);
                     break;
 
                 case 0xf4: // Enable Data Reporting (Stream Mode)
-                    printf("MS: Stream Mode ENABLED\n");
-                    ms_streaming = true;
-                    ms_remote = false;
-                    ms_reset();
-                    add_alarm_in_ms(100, ms_send_callback, NULL, false);
+                    host->streaming = true;
+                    host->remote = false;
+                    ps2out_flush(&host->out);
+                    ms_reset(host);
+                    // Queued packets were dropped, report the current
+                    // button state in the first packet regardless
+                    host->buttons_changed = true;
+                    ms_sample_start(host, 100000);
                     break;
 
                 case 0xf0: // Set Remote Mode
-                    printf("MS: Remote Mode ENABLED\n");
-                    ms_streaming = false;
-                    ms_remote = true;
-                    ms_reset();
+                    host->streaming = false;
+                    host->remote = true;
+                    ms_reset(host);
                     break;
 
-                case 0xf3: // Set Sample Rate (command byte, data handled in outer switch)
-                case 0xe8: // Set Resolution (command byte)
                 case 0xe6: // Set Scaling 1:1
+                    host->scaling = false;
+                    break;
+
                 case 0xe7: // Set Scaling 2:1
-                    // These commands just need ACK, data byte handled separately
+                    host->scaling = true;
+                    break;
+
+                case 0xf3: // Set Sample Rate (command byte, data handled in outer switch)
+                case 0xe8: // Set Resolution (command byte, data handled in outer switch)
                     break;
 
                 case 0xf2: // Get Device ID
-                    ms_out.packet[1] = 0xfa;
-                    ms_out.packet[2] = ms_type;
-                    ps2out_send(&ms_out, 2);
-                    ms_reset();
+                    ps2out_respond(&host->out, (const u8[]){ 0xfa, host->type }, 2);
+                    ms_reset(host);
                     return;
 
                 case 0xeb: // Read Data (used in Remote Mode, returns ACK + data packet)
                     // Send ACK first, then data packet
-                    ms_out.packet[1] = 0xfa;
-                    ps2out_send(&ms_out, 1);
-                    // Then send the movement packet
-                    ms_send_packet_now();
+                    ps2out_respond(&host->out, (const u8[]){ 0xfa }, 1);
+                    ms_packet p;
+                    ms_packetize(host, &p, false);
+                    ps2out_respond(&host->out, p.data, p.len);
                     return;
 
                 case 0xe9: // Status Request
-                    ms_out.packet[1] = 0xfa;
-                    ms_out.packet[2] = (ms_streaming << 5) | (ms_remote << 6);
-                    ms_out.packet[3] = 0x02; // Resolution
-                    ms_out.packet[4] = ms_rate;
-                    ps2out_send(&ms_out, 4);
+                    ps2out_respond(&host->out, (const u8[]){
+                        0xfa,
+                        (host->remote << 6) | (host->streaming << 5) | (host->scaling << 4) |
+                            (host->db << 2 & 0x04) | (host->db >> 1 & 0x02) | (host->db >> 1 & 0x01),
+                        host->resolution,
+                        host->rate
+                    }, 4);
                     return;
 
                 default:
-                    ms_reset();
+                    ms_reset(host);
                     break;
             }
             break;
     }
 
     // Send ACK
-    ms_out.packet[1] = 0xfa;
-    ps2out_send(&ms_out, 1);
+    ps2out_respond(&host->out, (const u8[]){ 0xfa }, 1);
 }
 
-static void ms_try_send(void) {
-    if (!ms_streaming) {
-        return;
-    }
-
-    // Check if there's data to send
-    bool has_data = ms_dx || ms_dy || ms_dz || ms_db || ms_buttons_changed;
+void ps2_mouse_select_host(u8 index) {
+    if (index >= PS2_HOST_COUNT || &ms_hosts[index] == ms_active) return;
+
+    // Let go of any held buttons on the old host. The pending button change
+    // makes its next sample slot request a packet, and ms_provide() forms
+    // it with the release once that host's line is free.
+    ms_host_t* host = ms_active;
+    u32 status = save_and_disable_interrupts();
+    if (host->db_prev) host->buttons_changed = true;
+    host->db = 0;
+    host->db_prev = 0;
+    host->dx = 0;
+    host->dy = 0;
+    host->dz = 0;
+    restore_interrupts(status);
+
+    ms_active = &ms_hosts[index];
+}
 
-    if (!has_data) {
-        if (!ms_ismoving) return;
-        ms_ismoving = false;
-    } else {
-        ms_ismoving = true;
-        ms_buttons_changed = false;
-    }
+bool ps2_mouse_reporting(u8 index) {
+    return ms_hosts[index].streaming || ms_hosts[index].remote;
+}
 
-    u8 byte1 = 0x08 | (ms_db & 0x07);
-    u8 byte2 = ms_clamp_xyz(ms_dx);
-    u8 byte3 = 0x100 - ms_clamp_xyz(ms_dy);
-    s8 byte4 = 0x100 - ms_dz;
+bool ps2_mouse_bat_sent(u8 index) {
+    return ms_hosts[index].bat_sent;
+}
 
-    if (ms_dx < 0) byte1 |= 0x10;
-    if (ms_dy > 0) byte1 |= 0x20;
-    if (byte2 == 0xaa) byte2 = 0xab;
-    if (byte3 == 0xaa) byte3 = 0xab;
+void ps2_mouse_print_stats(void) {
+    printf("Mouse: %lu packets, %lu slots skipped, worst late %lu us, "
+           "interval jitter max %lu us avg %lu us, data age max %lu us avg %lu us\n",
+           (unsigned long)ms_st_sent, (unsigned long)ms_st_skipped,
+           (unsigned long)ms_st_late_max, (unsigned long)ms_st_jitter_max,
+           (unsigned long)(ms_st_intervals ? ms_st_jitter_sum / ms_st_intervals : 0),
+           (unsigned long)ms_st_age_max,
+           (unsigned long)(ms_st_aged ? ms_st_age_sum / ms_st_aged : 0));
+}
 
-    u8 len = 0;
-    ms_out.packet[++len] = byte1;
-    ms_out.packet[++len] = byte2;
-    ms_out.packet[++len] = byte3;
+void ps2_mouse_reset_stats(void) {
+    u32 status = save_and_disable_interrupts();
+    ms_st_sent = 0;
+    ms_st_skipped = 0;
+    ms_st_late_max = 0;
+    ms_st_jitter_max = 0;
+    ms_st_jitter_sum = 0;
+    ms_st_intervals = 0;
+    ms_st_age_max = 0;
+    ms_st_age_sum = 0;
+    ms_st_aged = 0;
+    restore_interrupts(status);
+}
 
-    if (ms_type == 3 || ms_type == 4) {
-        if (byte4 < -8) byte4 = -8;
-        if (byte4 > 7) byte4 = 7;
+bool ps2_mouse_task(void) {
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        ms_host_t* host = &ms_hosts[i];
 
-        if (ms_type == 4) {
-            byte4 &= 0x0f;
-            byte4 |= (ms_db << 1) & 0x30;
+        if (host->bat_log) {
+            host->bat_log = false;
+            printf("MS: Sending BAT 0xAA, type=%d\n", host->bat_log_type);
         }
-
-        ms_out.packet[++len] = byte4;
     }
 
-    ms_dx = ms_remain_xyz(ms_dx);
-    ms_dy = ms_remain_xyz(ms_dy);
-    ms_dz = 0;
-    ps2out_send(&ms_out, len);
-}
-
-bool ps2_mouse_task(void) {
-    ps2out_task(&ms_out);
-    ms_try_send();
-    return ms_streaming && !ps2out_is_busy();
+    return ms_active->streaming && !ps2out_is_busy(&ms_active->out);
 }
 
 void ps2_mouse_init(void) {
-    // Use state machine 2 for mouse (keyboard uses SM 0)
-    ps2out_init(&ms_out, 2, PS2_MOUSE_DATA_PIN, &ms_receive);
-
-    // Delay BAT completion to allow host to boot
-    add_alarm_in_ms(500, ms_reset_callback, NULL, false);
+    tw_deadline_init(&ms_sample, ms_sample_irq);
+
+    for (u8 i = 0; i < PS2_HOST_COUNT; i++) {
+        ms_host_t* host = &ms_hosts[i];
+
+        host->rate = MS_RATE_DEFAULT;
+        host->resolution = MS_RES_DEFAULT;
+        ps2out_init(&host->out, ms_sms[i], ms_data_pins[i], &ms_receive, host);
+        ps2out_set_bit_rate(&host->out, PS2_MOUSE_BIT_RATE);
+        ps2out_set_packet_resend(&host->out, true);
+        ps2out_set_provider(&host->out, ms_provide);
+        ps2out_set_sent_callback(&host->out, ms_bat_sent);
+        tw_timer_init(&host->reset_timer, ms_reset_callback, host);
+
+        // Send BAT right away, it is held in the queue until the host
+        // releases the lines
+        ms_reset_callback(host);
+    }
 }
@@ -16,12 +16,37 @@
 #define PS2_MOUSE_DATA_PIN  14
 #define PS2_MOUSE_CLK_PIN   15
 
+// Second host's mouse (PS2_MULTI_HOST builds)
+#define PS2_MOUSE1_DATA_PIN 8
+#define PS2_MOUSE1_CLK_PIN  9
+
+// Device-to-host bit rate in Hz (11600-16000)
+#ifndef PS2_MOUSE_BIT_RATE
+#define PS2_MOUSE_BIT_RATE  PS2OUT_BIT_RATE_DEFAULT
+#endif
+
 // Initialize PS/2 mouse emulation
 void ps2_mouse_init(void);
 
-// Send mouse movement (called from USB HID callback)
+// Send mouse movement to the selected host (called from USB HID callback)
 // buttons: bit0=left, bit1=right, bit2=middle, bit3=back, bit4=forward
-void ps2_mouse_send_movement(u8 buttons, s8 x, s8 y, s8 wheel);
+// origin_us: the report's transfer-complete time (time_us_32())
+void ps2_mouse_send_movement(u8 buttons, s8 x, s8 y, s8 wheel, u32 origin_us);
+
+// Route movement to another host (0..PS2_HOST_COUNT-1). Buttons held on
+// the previous host are released there.
+void ps2_mouse_select_host(u8 index);
+
+// Check if a host has enabled stream or remote mode
+bool ps2_mouse_reporting(u8 index);
+
+// Check if a host's BAT (0xAA 0x00) went out on the wire; a BAT flushed
+// by a command or port restart does not count
+bool ps2_mouse_bat_sent(u8 index);
+
+// Print / clear sample clock statistics (packets, skipped slots, jitter)
+void ps2_mouse_print_stats(void);
+void ps2_mouse_reset_stats(void);
 
 // Process mouse tasks (call in main loop)
 bool ps2_mouse_task(void);
@@ -9,18 +9,66 @@
  *
  * Features:
  *   - Single state machine handles both TX and RX
- *   - Asynchronous packet transmission via queue
- *   - Host command reception with parity checking
- *   - Automatic resend on transmission failure
+ *   - Interrupt-driven packet transmission; the SM times the inter-byte gap
+ *     and raises an IRQ per byte, so TX does not depend on the main loop
+ *   - Variable-length packets in single-producer/single-consumer byte
+ *     rings, committed atomically, with an overflow counter
+ *   - Response lane that preempts queued input at packet boundaries
+ *   - Overrun code on input overflow, with headroom reserved for releases
+ *   - Host command reception with parity checking, serviced from the same
+ *     interrupt so ACKs meet the host's deadline whatever the main loop does
+ *   - Per-port statistics: overflows, parity errors, worst command-to-ACK
+ *   - A packet interrupted by host inhibit is retransmitted from its
+ *     first byte, so multi-byte sequences never arrive misaligned
+ *   - Resend (FE) repeats the last byte, or the whole last packet for
+ *     ports set up with ps2out_set_packet_resend() (mouse)
+ *   - Just-in-time input: a provider fills a record only once the line is
+ *     free, so its content is as fresh as it can be when it goes out
+ *   - Input latency: each record carries its USB origin and commit time
+ *     to the stop bit of its last byte, feeding a per-port histogram
  *
  * SPDX-License-Identifier: MIT
  */
 
 #include "ps2out.h"
 #include "ps2out.pio.h"
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include <stdio.h>
+#include <string.h>
+
+// Retry interval while the host holds the bus after an aborted byte
+#define PS2OUT_RETRY_US 1000
+
+// Marks ps2out.urgent as holding a byte, so 0x00 can be resent too
+#define PS2OUT_URGENT 0x100
+
+// Record header: payload length, plus flags for the overrun record and
+// for a record whose delivery is reported (ps2out_respond_notify)
+#define PS2OUT_REC_LEN     0x3f
+#define PS2OUT_REC_NOTIFY  0x40
+#define PS2OUT_REC_OVERRUN 0x80
 
 static s8 ps2out_prg = -1;
+static ps2out* ps2out_ports[4];
+
+static void ps2out_drop(ps2out* this, ps2out_ring* ring);
+static bool ps2out_commit(ps2out* this, ps2out_ring* ring, const u8* data, u8 len, bool keep,
+                          u32 origin_us);
+
+// PIO clock divider giving bit_hz device-to-host bits per second
+static float ps2out_clkdiv(u32 bit_hz) {
+    return (float)clock_get_hz(clk_sys) / ((float)bit_hz * PS2OUT_TX_BIT_CYCLES);
+}
+
+// State machine clock actually produced by a divider, which the hardware
+// holds as 16.8 fixed point (truncated the same way as the SDK does)
+static u32 ps2out_sm_hz(float div) {
+    u32 div_int = (u16)div;
+    u32 div_frac = (u8)((div - div_int) * 256);
+    return (u32)(((u64)clock_get_hz(clk_sys) << 8) / (div_int * 256 + div_frac));
+}
 
 static u32 ps2_frame(u8 byte) {
     bool parity = 1;
@@ -30,107 +78,559 @@ static u32 ps2_frame(u8 byte) {
     return ((1 << 10) | (parity << 9) | (byte << 1)) ^ 0x7ff;
 }
 
-void ps2out_send(ps2out* this, u8 len) {
-    this->packet[0] = len;
-    queue_try_add(&this->packets, &this->packet);
+// ----------------------------------------------------------------------------
+// Latency
+// ----------------------------------------------------------------------------
+
+#define PS2OUT_STAMP_MASK (PS2OUT_STAMPS - 1)
+
+static void stamp_push(ps2out* this, u32 origin_us) {
+    ps2out_stamps* st = &this->stamps;
+    st->origin[st->head & PS2OUT_STAMP_MASK] = origin_us;
+    st->commit[st->head & PS2OUT_STAMP_MASK] = time_us_32();
+    st->head++;
+}
+
+static void lat_add(u32* max, u64* sum, u32 us) {
+    if (us > *max) *max = us;
+    *sum += us;
+}
+
+// The input record at the tail just finished its last stop bit
+static void ps2out_latency_record(ps2out* this) {
+    ps2out_stamps* st = &this->stamps;
+    ps2out_latency* lat = &this->latency;
+    u32 now = time_us_32();
+
+    if (st->tail == st->head) return;
+    u32 origin = st->origin[st->tail & PS2OUT_STAMP_MASK];
+    u32 commit = st->commit[st->tail & PS2OUT_STAMP_MASK];
+    st->tail++;
+
+    u32 start = this->lat_started ? this->lat_start : now;
+    this->lat_started = false;
+
+    u32 total = now - origin;
+    u8 bucket = total ? 31 - __builtin_clz(total) : 0;
+    if (bucket >= PS2OUT_LAT_BUCKETS) bucket = PS2OUT_LAT_BUCKETS - 1;
+
+    lat->count++;
+    lat->hist[bucket]++;
+    lat_add(&lat->total_max, &lat->total_sum, total);
+    lat_add(&lat->decode_max, &lat->decode_sum, commit - origin);
+    lat_add(&lat->queue_max, &lat->queue_sum, start - commit);
+    lat_add(&lat->line_max, &lat->line_sum, now - start);
+}
+
+// ----------------------------------------------------------------------------
+// Transmit engine (runs in PIO1_IRQ_0)
+// ----------------------------------------------------------------------------
+
+static void ps2out_kick(void) {
+    irq_set_pending(PIO1_IRQ_0);
+}
+
+static u32 ps2out_retry_cb(void* ctx) {
+    (void)ctx;
+    ps2out_kick();
+    return 0;
+}
+
+static void ps2out_put(ps2out* this, u8 byte) {
+    this->in_flight = true;
+    pio_sm_put(pio1, this->sm, ps2_frame(byte));
+}
+
+static bool ring_empty(ps2out_ring* ring) {
+    return ring->tail == ring->head;
+}
+
+static u8 ring_free(ps2out_ring* ring) {
+    return ring->tail - ring->head - 1;
 }
 
-void ps2out_init(ps2out* this, u8 sm, u8 data_pin, rx_callback rx_function) {
-    ps2out_init_ex(this, sm, data_pin, data_pin + 1, rx_function);
+// Append one record. Called with interrupts masked (or from the
+// interrupt itself): keyboard repeat and mouse reports are produced from
+// timer callbacks as well as the main loop. The consumer only ever sees
+// head move past a complete record.
+static void ring_commit(ps2out_ring* ring, u8 hdr, const u8* data, u8 len) {
+    u8 head = ring->head;
+
+    ring->buf[head] = hdr;
+    for (u8 i = 0; i < len; i++) {
+        ring->buf[(u8)(head + 1 + i)] = data[i];
+    }
+    __dmb();
+    ring->head = head + 1 + len;
+}
+
+// Serve a request: have the provider fill a record and queue it. Only
+// called with both lanes empty, so it always fits.
+static bool ps2out_provide(ps2out* this) {
+    u8 data[PS2OUT_MAX_PACKET];
+    bool release = false;
+    u32 origin = 0;
+
+    this->requested = false;
+    u8 len = this->provider(this->rx_ctx, data, &release, &origin);
+    return len && ps2out_commit(this, &this->input, data, len, release, origin);
+}
+
+// Retire the record being sent once its last byte is out
+static void ps2out_retire(ps2out* this) {
+    ps2out_ring* ring = this->current;
+    u8 hdr = ring->buf[ring->tail];
+
+    ring->tail = ring->tail + 1 + (hdr & PS2OUT_REC_LEN);
+    if (ring == &this->input) ps2out_latency_record(this);
+    this->sent = 0;
+    this->current = NULL;
+    if (hdr & PS2OUT_REC_OVERRUN) this->overrun = false;
+    if (hdr & PS2OUT_REC_NOTIFY && this->sent_function) this->sent_function(this->rx_ctx);
 }
 
-void ps2out_init_ex(ps2out* this, u8 sm, u8 data_pin, u8 clk_pin, rx_callback rx_function) {
+// Feed the next byte to the SM. Only one byte is ever in flight so an abort
+// can always be rewound, and nothing is handed over while the host holds
+// CLK or DATA low - a byte sitting in the OSR would otherwise go out ahead
+// of our reply to whatever the host is about to send.
+static void ps2out_pump(ps2out* this) {
+    if (this->in_flight) return;
+
+    if (!gpio_get(this->data_pin) || !gpio_get(this->clk_pin)) {
+        if (!ps2out_is_idle(this) && !tw_armed(&this->retry)) {
+            tw_arm(&this->retry, PS2OUT_RETRY_US);
+        }
+        return;
+    }
+
+    if (this->urgent) {
+        this->tx_urgent = this->urgent;
+        this->urgent = 0;
+        ps2out_put(this, this->tx_urgent & 0xff);
+        return;
+    }
+
+    for (;;) {
+        // Lanes are only switched between records, never inside one
+        if (!this->current) {
+            if (!ring_empty(&this->response)) {
+                this->current = &this->response;
+            } else if (!ring_empty(&this->input)) {
+                this->current = &this->input;
+            } else if (this->requested && this->provider && ps2out_provide(this)) {
+                this->current = &this->input;
+            } else {
+                return;
+            }
+        }
+
+        ps2out_ring* ring = this->current;
+        u8 hdr = ring->buf[ring->tail];
+        u8 len = hdr & PS2OUT_REC_LEN;
+
+        if (this->sent < len) {
+            if (this->sent == 0) {
+                // First reply byte after a command: time it to completion
+                if (ring == &this->response && this->ack_pending) {
+                    this->ack_pending = false;
+                    this->ack_in_flight = true;
+                }
+
+                // Latency counts the line from the first attempt, so a
+                // record restarted after an inhibit keeps its start
+                if (ring == &this->input && !this->lat_started) {
+                    this->lat_start = time_us_32();
+                    this->lat_started = true;
+                }
+
+                // Keep a copy for a packet-level resend
+                if (this->packet_resend) {
+                    for (u8 i = 0; i < len; i++) {
+                        this->last_packet[i] = ring->buf[(u8)(ring->tail + 1 + i)];
+                    }
+                    this->last_len = len;
+                }
+            }
+            this->last_tx = ring->buf[(u8)(ring->tail + 1 + this->sent++)];
+            ps2out_put(this, this->last_tx);
+            return;
+        }
+
+        ps2out_retire(this);
+    }
+}
+
+// Handle one byte from the host. Runs in the interrupt, so the device's
+// rx_function must only queue replies and update state, never block.
+static void ps2out_rx(ps2out* this, u32 raw_fifo) {
+    u32 fifo = raw_fifo >> 23;
+
+    // Verify parity
+    bool parity = 1;
+    for (u8 i = 0; i < 8; i++) {
+        parity = parity ^ (fifo >> i & 1);
+    }
+
+    if (parity != (fifo >> 8)) {
+        // Parity error, request resend
+        this->parity_errors++;
+        this->urgent = PS2OUT_URGENT | 0xfe;
+        return;
+    }
+
+    if ((fifo & 0xff) == 0xfe) {
+        // Host requested resend: the last packet goes back to the front
+        // of the response lane, or the last byte out of band
+        if (this->packet_resend && this->last_len) {
+            ps2out_drop(this, &this->response);
+            ring_commit(&this->response, this->last_len, this->last_packet, this->last_len);
+        } else {
+            this->urgent = PS2OUT_URGENT | this->last_tx;
+        }
+        return;
+    }
+
+    // A new command supersedes any unsent reply to the previous one.
+    // Queued input is left alone; the handler flushes it where the
+    // protocol says so.
+    ps2out_drop(this, &this->response);
+    this->urgent = 0;
+    this->rx_us = time_us_32();
+    this->ack_pending = true;
+    this->ack_in_flight = false;
+
+    // Call the receive callback
+    (*this->rx_function)(this->rx_ctx, fifo, this->last_rx);
+    this->last_rx = fifo;
+}
+
+static void ps2out_irq_handler(void) {
+    for (u8 sm = 0; sm < 4; sm++) {
+        ps2out* this = ps2out_ports[sm];
+        if (!this) continue;
+
+        if (pio_interrupt_get(pio1, sm)) {
+            // The SM stalls on the abort path until the flag is cleared,
+            // which is how a failed byte is told apart from a sent one
+            if (pio_sm_get_pc(pio1, sm) == ps2out_prg + ps2out_offset_abort) {
+                // Host inhibit: start the whole packet over once the bus
+                // is free, after any reply the host's command asks for
+                this->inhibits++;
+                if (this->tx_urgent) {
+                    if (!this->urgent) this->urgent = this->tx_urgent;
+                } else {
+                    this->sent = 0;
+                    this->current = NULL;
+                }
+                this->ack_pending |= this->ack_in_flight;
+            } else {
+                if (this->ack_in_flight) {
+                    u32 latency = time_us_32() - this->rx_us;
+                    if (latency > this->ack_max_us) this->ack_max_us = latency;
+                }
+
+                // Last byte of the record acknowledged: retire it here, so
+                // the latency ends at its stop bit even if an inhibit
+                // holds off the next pump
+                ps2out_ring* ring = this->current;
+                if (!this->tx_urgent && ring &&
+                    this->sent == (ring->buf[ring->tail] & PS2OUT_REC_LEN)) {
+                    ps2out_retire(this);
+                }
+            }
+            this->ack_in_flight = false;
+            this->tx_urgent = 0;
+            this->in_flight = false;
+            pio_interrupt_clear(pio1, sm);
+        }
+
+        while (!pio_sm_is_rx_fifo_empty(pio1, sm)) {
+            ps2out_rx(this, pio_sm_get(pio1, sm));
+        }
+
+        ps2out_pump(this);
+    }
+}
+
+// Commit one record, interrupts masked. Input records get a latency stamp
+// (the overrun record stands in for the input it replaced).
+static bool ps2out_commit(ps2out* this, ps2out_ring* ring, const u8* data, u8 len, bool keep,
+                          u32 origin_us) {
+    if (!len || len > PS2OUT_MAX_PACKET) return false;
+
+    u8 room = ring_free(ring);
+
+    // Ordinary input stops short of the reserve, and is dropped outright
+    // while an overrun code is still waiting to go out
+    if (ring == &this->input && !keep) {
+        room = room > PS2OUT_RESERVE ? room - PS2OUT_RESERVE : 0;
+        if (this->overrun) room = 0;
+    }
+
+    if (room < len + 1) {
+        this->overflows++;
+        if (ring == &this->input && !keep && this->overrun_enabled && !this->overrun &&
+            ring_free(ring) >= 2) {
+            ring_commit(ring, PS2OUT_REC_OVERRUN | 1, &this->overrun_code, 1);
+            stamp_push(this, origin_us);
+            this->overrun = true;
+        }
+        return false;
+    }
+
+    ring_commit(ring, len, data, len);
+    if (ring == &this->input) stamp_push(this, origin_us);
+    return true;
+}
+
+static bool ps2out_enqueue(ps2out* this, ps2out_ring* ring, const u8* data, u8 len, bool keep,
+                           u32 origin_us) {
+    u32 status = save_and_disable_interrupts();
+    bool ok = ps2out_commit(this, ring, data, len, keep, origin_us);
+    restore_interrupts(status);
+
+    ps2out_kick();
+    return ok;
+}
+
+bool ps2out_send(ps2out* this, const u8* data, u8 len) {
+    return ps2out_enqueue(this, &this->input, data, len, false, time_us_32());
+}
+
+bool ps2out_send_release(ps2out* this, const u8* data, u8 len) {
+    return ps2out_enqueue(this, &this->input, data, len, true, time_us_32());
+}
+
+bool ps2out_send_timed(ps2out* this, const u8* data, u8 len, bool release, u32 origin_us) {
+    return ps2out_enqueue(this, &this->input, data, len, release, origin_us);
+}
+
+u32 ps2out_send_batch(ps2out* this, const u8* data, const u8* lens, u32 release, u8 count,
+                      u32 origin_us) {
+    u32 refused = 0;
+
+    u32 status = save_and_disable_interrupts();
+    for (u8 i = 0; i < count; i++) {
+        if (!ps2out_commit(this, &this->input, data, lens[i], release >> i & 1, origin_us)) {
+            refused |= 1u << i;
+        }
+        data += lens[i];
+    }
+    restore_interrupts(status);
+
+    ps2out_kick();
+    return refused;
+}
+
+void ps2out_set_provider(ps2out* this, tx_provider provider) {
+    this->provider = provider;
+}
+
+void ps2out_request(ps2out* this) {
+    this->requested = true;
+    ps2out_kick();
+}
+
+bool ps2out_requested(ps2out* this) {
+    return this->requested;
+}
+
+bool ps2out_respond(ps2out* this, const u8* data, u8 len) {
+    return ps2out_enqueue(this, &this->response, data, len, true, 0);
+}
+
+bool ps2out_respond_notify(ps2out* this, const u8* data, u8 len) {
+    if (!len || len > PS2OUT_MAX_PACKET) return false;
+
+    u32 status = save_and_disable_interrupts();
+    bool ok = ring_free(&this->response) >= len + 1;
+    if (ok) {
+        ring_commit(&this->response, PS2OUT_REC_NOTIFY | len, data, len);
+    } else {
+        this->overflows++;
+    }
+    restore_interrupts(status);
+
+    ps2out_kick();
+    return ok;
+}
+
+void ps2out_set_sent_callback(ps2out* this, tx_sent_callback sent_function) {
+    this->sent_function = sent_function;
+}
+
+// Drop everything queued in a lane, including a partly sent record
+static void ps2out_drop(ps2out* this, ps2out_ring* ring) {
+    u32 status = save_and_disable_interrupts();
+    ring->tail = ring->head;
+    if (this->current == ring) {
+        this->current = NULL;
+        this->sent = 0;
+    }
+    if (ring == &this->input) {
+        this->overrun = false;
+        this->stamps.tail = this->stamps.head;
+        this->lat_started = false;
+    }
+    restore_interrupts(status);
+}
+
+void ps2out_flush(ps2out* this) {
+    ps2out_drop(this, &this->input);
+}
+
+void ps2out_set_packet_resend(ps2out* this, bool enabled) {
+    this->packet_resend = enabled;
+}
+
+void ps2out_set_overrun_code(ps2out* this, u8 code) {
+    this->overrun_code = code;
+    this->overrun_enabled = true;
+}
+
+void ps2out_init(ps2out* this, u8 sm, u8 data_pin, rx_callback rx_function, void* rx_ctx) {
+    ps2out_init_ex(this, sm, data_pin, data_pin + 1, rx_function, rx_ctx);
+}
+
+void ps2out_init_ex(ps2out* this, u8 sm, u8 data_pin, u8 clk_pin, rx_callback rx_function, void* rx_ctx) {
     this->sm = sm;
     this->data_pin = data_pin;
     this->clk_pin = clk_pin;
     this->rx_function = rx_function;
+    this->rx_ctx = rx_ctx;
     this->last_rx = 0;
     this->last_tx = 0;
     this->sent = 0;
-    this->busy = 0;
-
-    queue_init(&this->packets, 9, 32);
+    this->urgent = 0;
+    this->in_flight = false;
+    this->provider = NULL;
+    this->sent_function = NULL;
+    this->requested = false;
+    tw_timer_init(&this->retry, ps2out_retry_cb, this);
+    this->response.head = this->response.tail = 0;
+    this->input.head = this->input.tail = 0;
+    this->current = NULL;
+    this->overrun_enabled = false;
+    this->overrun_code = 0;
+    this->overrun = false;
+    this->overflows = 0;
+    this->parity_errors = 0;
+    this->inhibits = 0;
+    this->ack_max_us = 0;
+    this->tx_urgent = 0;
+    this->packet_resend = false;
+    this->last_len = 0;
+    this->ack_pending = false;
+    this->ack_in_flight = false;
+    this->stamps.head = this->stamps.tail = 0;
+    this->lat_started = false;
+    memset(&this->latency, 0, sizeof(this->latency));
 
     // Add program once, share between keyboard and mouse
     if (ps2out_prg == -1) {
         ps2out_prg = pio_add_program(pio1, &ps2out_program);
+        irq_add_shared_handler(PIO1_IRQ_0, ps2out_irq_handler,
+                               PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(PIO1_IRQ_0, true);
     }
 
-    ps2out_program_init_ex(pio1, sm, ps2out_prg, data_pin, clk_pin);
+    // Claimed, so a later pio_claim_unused_sm() (line analyzer) skips it
+    if (!pio_sm_is_claimed(pio1, sm)) pio_sm_claim(pio1, sm);
+    ps2out_ports[sm] = this;
+    this->bit_rate = PS2OUT_BIT_RATE_DEFAULT;
+    ps2out_program_init_ex(pio1, sm, ps2out_prg, data_pin, clk_pin, ps2out_clkdiv(this->bit_rate));
+    pio_set_irq0_source_enabled(pio1, pis_interrupt0 + sm, true);
+    pio_set_irq0_source_enabled(pio1, pis_sm0_rx_fifo_not_empty + sm, true);
 }
 
-bool ps2out_is_busy(void) {
-    // Check if any state machine has its busy flag set
-    // SM 0 = keyboard, SM 2 = mouse
-    return pio_interrupt_get(pio1, 0) || pio_interrupt_get(pio1, 2);
+u32 ps2out_set_bit_rate(ps2out* this, u32 hz) {
+    if (hz < PS2OUT_BIT_RATE_MIN) hz = PS2OUT_BIT_RATE_MIN;
+    if (hz > PS2OUT_BIT_RATE_MAX) hz = PS2OUT_BIT_RATE_MAX;
+
+    this->bit_rate = hz;
+    float div = ps2out_clkdiv(hz);
+    pio_sm_set_clkdiv(pio1, this->sm, div);
+
+    // Report what the quantized divider really gives, not the request
+    u32 sm_hz = ps2out_sm_hz(div);
+    u32 tx_ns = (u32)(PS2OUT_TX_BIT_CYCLES * 1000000000ull / sm_hz);
+    printf("PIO SM%d: clk_sys %lu Hz, div %.4f, TX bit %lu ns (CLK low %lu ns), RX bit %lu ns, "
+           "max %lu bytes/s\n",
+           this->sm, (unsigned long)clock_get_hz(clk_sys), (double)div, (unsigned long)tx_ns,
+           (unsigned long)(tx_ns * 12 / PS2OUT_TX_BIT_CYCLES),
+           (unsigned long)(tx_ns * PS2OUT_RX_BIT_CYCLES / PS2OUT_TX_BIT_CYCLES),
+           (unsigned long)(sm_hz / PS2OUT_TX_BYTE_CYCLES));
+    return hz;
 }
 
-void ps2out_task(ps2out* this) {
-    u8 packet[9];
+bool ps2out_is_busy(ps2out* this) {
+    return this->in_flight || !ring_empty(&this->input);
+}
 
-    // Check busy flag (IRQ 0 relative to state machine)
-    bool is_busy = pio_interrupt_get(pio1, this->sm);
-    
-    if (this->busy) {
-        this->busy--;
-        if (is_busy) {
-            this->busy = 0;
-        }
-    }
+bool ps2out_is_idle(ps2out* this) {
+    return ring_empty(&this->response) && ring_empty(&this->input) &&
+           !this->in_flight && !this->urgent && !this->requested;
+}
 
-    // Check if we can send: not busy, both lines high, and have data to send
-    if (!this->busy && !is_busy &&
-        gpio_get(this->data_pin) && gpio_get(this->clk_pin) &&
-        queue_try_peek(&this->packets, &packet)) {
-        
-        if (this->sent == packet[0]) {
-            queue_try_remove(&this->packets, &packet);
-            this->sent = 0;
-        } else {
-            this->sent++;
-            this->last_tx = packet[this->sent];
-            this->busy = 100;
-            pio_sm_put(pio1, this->sm, ps2_frame(this->last_tx));
-        }
+void ps2out_print_stats(void) {
+    for (u8 sm = 0; sm < 4; sm++) {
+        ps2out* this = ps2out_ports[sm];
+        if (!this) continue;
+        printf("PIO SM%d: %lu Hz, overflows %lu, parity errors %lu, inhibits %lu, worst ACK %lu us\n",
+               sm, (unsigned long)this->bit_rate, (unsigned long)this->overflows,
+               (unsigned long)this->parity_errors, (unsigned long)this->inhibits,
+               (unsigned long)this->ack_max_us);
     }
+}
 
-    // Check for TX failure (IRQ 4 relative to state machine)
-    if (pio_interrupt_get(pio1, this->sm + 4)) {
-        if (this->sent > 0) this->sent--;
-        pio_interrupt_clear(pio1, this->sm + 4);
-        pio_interrupt_clear(pio1, this->sm);
+void ps2out_reset_stats(void) {
+    for (u8 sm = 0; sm < 4; sm++) {
+        ps2out* this = ps2out_ports[sm];
+        if (!this) continue;
+        this->overflows = 0;
+        this->parity_errors = 0;
+        this->inhibits = 0;
+        this->ack_max_us = 0;
     }
+}
 
-    // Check for received data from host
-    if (!pio_sm_is_rx_fifo_empty(pio1, this->sm)) {
-        u32 raw_fifo = pio_sm_get(pio1, this->sm);
-        u32 fifo = raw_fifo >> 23;
+void ps2out_print_latency(void) {
+    for (u8 sm = 0; sm < 4; sm++) {
+        ps2out* this = ps2out_ports[sm];
+        if (!this) continue;
 
-        // Verify parity
-        bool parity = 1;
-        for (u8 i = 0; i < 8; i++) {
-            parity = parity ^ (fifo >> i & 1);
-        }
+        // Snapshot so the IRQ cannot update it halfway through printing
+        u32 status = save_and_disable_interrupts();
+        ps2out_latency lat = this->latency;
+        restore_interrupts(status);
 
-        if (parity != (fifo >> 8)) {
-            // Parity error, request resend
-            printf("PIO SM%d parity error fifo=0x%03lX\n", this->sm, (unsigned long)fifo);
-            pio_sm_put(pio1, this->sm, ps2_frame(0xfe));
-            return;
-        }
+        u32 n = lat.count ? lat.count : 1;
+        printf("PIO SM%d latency: %lu records, avg/worst us: total %lu/%lu, decode %lu/%lu, "
+               "queue %lu/%lu, line %lu/%lu\n",
+               sm, (unsigned long)lat.count,
+               (unsigned long)(lat.total_sum / n), (unsigned long)lat.total_max,
+               (unsigned long)(lat.decode_sum / n), (unsigned long)lat.decode_max,
+               (unsigned long)(lat.queue_sum / n), (unsigned long)lat.queue_max,
+               (unsigned long)(lat.line_sum / n), (unsigned long)lat.line_max);
 
-        if ((fifo & 0xff) == 0xfe) {
-            // Host requested resend
-            pio_sm_put(pio1, this->sm, ps2_frame(this->last_tx));
-            return;
+        for (u8 i = 0; i < PS2OUT_LAT_BUCKETS; i++) {
+            if (!lat.hist[i]) continue;
+            if (i == PS2OUT_LAT_BUCKETS - 1) {
+                printf("  >= %lu us: %lu\n", 1ul << i, (unsigned long)lat.hist[i]);
+            } else {
+                printf("  %lu-%lu us: %lu\n", i ? 1ul << i : 0ul, (2ul << i) - 1,
+                       (unsigned long)lat.hist[i]);
+            }
         }
+    }
+}
 
-        // Clear pending packets when host sends command
-        while (queue_try_remove(&this->packets, &packet));
-        this->sent = 0;
-
-        // Call the receive callback
-        (*this->rx_function)(fifo, this->last_rx);
-        this->last_rx = fifo;
+void ps2out_reset_latency(void) {
+    for (u8 sm = 0; sm < 4; sm++) {
+        ps2out* this = ps2out_ports[sm];
+        if (!this) continue;
+        u32 status = save_and_disable_interrupts();
+        memset(&this->latency, 0, sizeof(this->latency));
+        restore_interrupts(status);
     }
 }
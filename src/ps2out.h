@@ -2,7 +2,8 @@
  * Hecate - PS/2 PIO Communication Driver
  *
  * Public interface for the PS/2 PIO communication layer.
- * Provides queue-based packet transmission and host command reception.
+ * Provides interrupt-driven packet transmission from a per-port byte ring
+ * and host command reception.
  *
  * SPDX-License-Identifier: MIT
  */
@@ -13,8 +14,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "pico/stdlib.h"
-#include "pico/util/queue.h"
 #include "hardware/pio.h"
+#include "timer_wheel.h"
 
 typedef int8_t s8;
 typedef int16_t s16;
@@ -25,36 +26,201 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 
-typedef void (*rx_callback)(u8 byte, u8 prev_byte);
+// Called from PIO1_IRQ_0 for every host byte other than a resend request
+typedef void (*rx_callback)(void* ctx, u8 byte, u8 prev_byte);
+
+// Supplies an input record just in time: called from PIO1_IRQ_0 with
+// rx_ctx once ps2out_request() was made and the port has nothing else to
+// send, right before the record's first byte goes out. Writes up to
+// PS2OUT_MAX_PACKET bytes to data and returns the length (0 = nothing to
+// send after all); release and origin_us as for ps2out_send_timed().
+typedef u8 (*tx_provider)(void* ctx, u8* data, bool* release, u32* origin_us);
+
+// Called from PIO1_IRQ_0 with rx_ctx once the stop bit of the last byte
+// of a record queued by ps2out_respond_notify() went out without an
+// inhibit. Not called for a record dropped before it was sent.
+typedef void (*tx_sent_callback)(void* ctx);
+
+// Transmit ring. Holds length-prefixed records back to back; u8 indices
+// wrap with the buffer so no masking is needed.
+#define PS2OUT_RING_SIZE 256
+
+// Longest record a single send accepts
+#define PS2OUT_MAX_PACKET 16
+
+// Device-to-host bit rate. The spec allows 10-16.7kHz, but the SM's clock
+// low phase drops under the 30us minimum above 16kHz and its RX bit rate
+// (29 vs 25 cycles) falls under 10kHz below 11.6kHz.
+#define PS2OUT_BIT_RATE_MIN     11600
+#define PS2OUT_BIT_RATE_MAX     16000
+#define PS2OUT_BIT_RATE_DEFAULT 15000
+
+// Number of PS/2 hosts, each with a keyboard and a mouse port. A second
+// host uses pio1 SM1 (keyboard) and SM3 (mouse).
+#ifndef PS2_HOST_COUNT
+#define PS2_HOST_COUNT 1
+#endif
+
+// Input-lane space only releases (key breaks, button-up packets) and the
+// overrun code may use, so a full buffer can never leave a key stuck down
+#define PS2OUT_RESERVE 96
+
+typedef struct {
+    u8 buf[PS2OUT_RING_SIZE];
+    volatile u8 head;   // Producer: next free byte, published after the record
+    volatile u8 tail;   // Consumer (IRQ): start of the oldest record
+} ps2out_ring;
+
+// Latency stamps, one per queued input record. A record is at least two
+// bytes, so the ring can never hold more than this many.
+#define PS2OUT_STAMPS 128
+
+// Latency histogram buckets: bucket n counts totals of 2^n..2^(n+1)-1 us,
+// the last one everything longer
+#define PS2OUT_LAT_BUCKETS 20
+
+typedef struct {
+    u32 origin[PS2OUT_STAMPS];  // USB transfer complete (or event) time
+    u32 commit[PS2OUT_STAMPS];  // Record committed to the input lane
+    u8 head;
+    u8 tail;
+} ps2out_stamps;
+
+// Per-port input latency, USB report to the stop bit of the record's
+// last byte. decode = origin -> commit, queue = commit -> first start
+// bit, line = first start bit -> last stop bit (including retransmits).
+typedef struct {
+    u32 count;
+    u32 hist[PS2OUT_LAT_BUCKETS];
+    u32 total_max;
+    u32 decode_max;
+    u32 queue_max;
+    u32 line_max;
+    u64 total_sum;
+    u64 decode_sum;
+    u64 queue_sum;
+    u64 line_sum;
+} ps2out_latency;
 
 typedef struct {
     u8 sm;              // Single state machine for TX and RX
     u8 data_pin;
     u8 clk_pin;
-    queue_t packets;
-    u8 packet[9];
+    u32 bit_rate;       // TX bit rate in Hz, as applied
+    ps2out_ring response;   // Replies to host commands, sent first
+    ps2out_ring input;      // Scancodes / movement packets
+    ps2out_ring* current;   // Lane of the record being sent, NULL between records
+    bool overrun_enabled;   // Emit overrun_code when input overflows (keyboard)
+    u8 overrun_code;
+    volatile bool overrun;  // Overrun code queued, input dropped until it is sent
+    u32 overflows;          // Records dropped because a lane was full
+    u32 parity_errors;      // Host bytes answered with FE
+    u32 inhibits;           // Packets restarted after the host pulled CLK low
+    u32 ack_max_us;         // Worst command received -> first reply byte sent
+    u32 rx_us;              // When the last command was received
+    bool ack_pending;       // Command received, first reply byte not started
+    bool ack_in_flight;     // First reply byte on the wire
     rx_callback rx_function;
+    void* rx_ctx;
     u8 last_rx;
     u8 last_tx;
     u8 sent;
-    u8 busy;
+    volatile u16 urgent;    // Out-of-band byte (resend / FE), sent before the ring
+    u16 tx_urgent;          // Out-of-band byte currently in flight
+    bool packet_resend;     // FE repeats the whole last packet, not one byte
+    u8 last_packet[PS2OUT_MAX_PACKET];
+    u8 last_len;
+    volatile bool in_flight;
+    tw_timer retry;         // Re-pump once the host releases the lines
+    tx_provider provider;
+    tx_sent_callback sent_function;
+    volatile bool requested;    // Provider asked for a record, not yet called
+    ps2out_stamps stamps;   // Timing of the records in the input lane
+    u32 lat_start;          // First start bit of the current input record
+    bool lat_started;
+    ps2out_latency latency;
 } ps2out;
 
 // Initialize PS/2 output
-// sm: State machine number (0 for keyboard, 2 for mouse)
+// sm: State machine number (0/1 for keyboards, 2/3 for mice)
 // data_pin: GPIO for data line (clock is data_pin + 1)
-void ps2out_init(ps2out* this, u8 sm, u8 data_pin, rx_callback rx_function);
+// rx_ctx: passed back to rx_function
+void ps2out_init(ps2out* this, u8 sm, u8 data_pin, rx_callback rx_function, void* rx_ctx);
 
 // Extended init with explicit clock pin
-void ps2out_init_ex(ps2out* this, u8 sm, u8 data_pin, u8 clk_pin, rx_callback rx_function);
+void ps2out_init_ex(ps2out* this, u8 sm, u8 data_pin, u8 clk_pin, rx_callback rx_function, void* rx_ctx);
+
+// Set the TX bit rate in Hz (clamped to PS2OUT_BIT_RATE_MIN..MAX) from the
+// current clk_sys. Returns the rate applied. Call again after changing
+// the system clock.
+u32 ps2out_set_bit_rate(ps2out* this, u32 hz);
+
+// Queue input for sending as one record. Returns false (and counts an
+// overflow) if it does not fit; a record is never split or partly sent.
+bool ps2out_send(ps2out* this, const u8* data, u8 len);
+
+// Queue input that must not be lost (key break, button release). May use
+// the reserved headroom and is accepted even while in overrun.
+bool ps2out_send_release(ps2out* this, const u8* data, u8 len);
+
+// ps2out_send / ps2out_send_release with the time (time_us_32()) the
+// event entered the firmware, for the latency statistics. Plain sends
+// count from the call.
+bool ps2out_send_timed(ps2out* this, const u8* data, u8 len, bool release, u32 origin_us);
+
+// Queue several input records in one critical section: count records of
+// lens[i] bytes, back to back in data. Bit i of release marks record i as
+// a release (may use the reserve). All share one origin time. Returns a
+// mask of the records refused.
+u32 ps2out_send_batch(ps2out* this, const u8* data, const u8* lens, u32 release, u8 count,
+                      u32 origin_us);
+
+// Register the just-in-time provider of input records
+void ps2out_set_provider(ps2out* this, tx_provider provider);
+
+// Ask the provider for one record as soon as the line is free: after the
+// byte in flight, queued input and any host inhibit. Repeated requests
+// before it is served collapse into one.
+void ps2out_request(ps2out* this);
+
+// Check if a request is still waiting for the line
+bool ps2out_requested(ps2out* this);
+
+// Queue a reply to a host command. Goes ahead of queued input at the next
+// packet boundary, so response latency is bounded by one input packet.
+bool ps2out_respond(ps2out* this, const u8* data, u8 len);
+
+// ps2out_respond() for a record whose delivery matters (the BAT): the
+// port's sent callback runs once all of it is on the wire
+bool ps2out_respond_notify(ps2out* this, const u8* data, u8 len);
+
+// Register the callback for records queued with ps2out_respond_notify()
+void ps2out_set_sent_callback(ps2out* this, tx_sent_callback sent_function);
+
+// Discard queued input (reset, enable/disable, set defaults)
+void ps2out_flush(ps2out* this);
+
+// Answer a host resend (FE) with the whole last packet instead of the last
+// byte. The mouse protocol requires this; the keyboard resends one byte.
+void ps2out_set_packet_resend(ps2out* this, bool enabled);
+
+// Enable the overrun code the port sends in place of dropped input
+// (0x00 for scancode sets 2/3, 0xFF for set 1)
+void ps2out_set_overrun_code(ps2out* this, u8 code);
+
+// Check if this port is still sending or has input queued. Each port is
+// independent; producers use this for backpressure on their own channel.
+bool ps2out_is_busy(ps2out* this);
 
-// Process PS/2 tasks (send queued data, receive host commands)
-void ps2out_task(ps2out* this);
+// Check if this port has nothing queued (in either lane), requested or in flight
+bool ps2out_is_idle(ps2out* this);
 
-// Queue packet for sending (packet[0] = length, packet[1..] = data)
-void ps2out_send(ps2out* this, u8 len);
+// Print / clear per-port statistics on the debug UART
+void ps2out_print_stats(void);
+void ps2out_reset_stats(void);
 
-// Check if PS/2 bus is busy
-bool ps2out_is_busy(void);
+// Print / clear per-port input latency (histogram, averages, worst cases)
+void ps2out_print_latency(void);
+void ps2out_reset_latency(void);
 
 #endif // PS2OUT_H
@@ -0,0 +1,348 @@
+/*
+ * Hecate - PS/2 Line Analyzer
+ *
+ * Passive capture of the PS/2 keyboard and mouse lines, for debugging host
+ * compatibility without a logic analyzer. One receive-only PIO state
+ * machine per channel reports every CLK rising edge together with the
+ * DATA level and the preceding CLK low time; the edges are decoded into
+ * frames here, in the PIO interrupt.
+ *
+ * Recorded per frame:
+ *   - Timestamp of the first edge (microseconds since boot)
+ *   - Direction (device-to-host or host-to-device)
+ *   - Byte, parity status, framing errors
+ *   - Frame duration and average CLK low time (bit timing)
+ *   - Host inhibits, including those that abort a frame
+ *
+ * The dump adds the gap to the previous frame on the same channel, which
+ * gives inter-byte gaps and host/device response times directly.
+ *
+ * Edge times are rebuilt from the CLK high and low times the state machine
+ * counts, so all edges drained in one interrupt keep their own time. The
+ * interrupt clock only anchors the chain at the first edge and after a
+ * counter ran out or the FIFO overflowed (reported as a capture error).
+ *
+ * The state machines are spare ones: pio0 after PIO-USB, else pio1 after
+ * the PS/2 ports. Keyboard capture is set up first, so with one free SM
+ * only the keyboard line is recorded.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ps2sniff.h"
+#include "ps2sniff.pio.h"
+#include "ps2_keyboard.h"
+#include "ps2_mouse.h"
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include <stdio.h>
+
+// Low-time counter rate: 10MHz gives 0.1us resolution
+#define SNIFF_COUNT_HZ      10000000
+
+// CLK low longer than any device clock pulse (30-50us) is the host
+#define SNIFF_INHIBIT_US    60
+
+// No edge for this long ends a frame in progress
+#define SNIFF_IDLE_US       300
+
+// Ring of decoded frames, power of two
+#define SNIFF_RING_SIZE     512
+
+// Frame flags
+#define SNIFF_H2D           0x01    // Host-to-device
+#define SNIFF_PARITY_ERR    0x02
+#define SNIFF_FRAMING_ERR   0x04    // Bad stop bit or too few edges
+#define SNIFF_INHIBIT       0x08    // Host held CLK low
+#define SNIFF_ABORTED       0x10    // Frame cut short by a host inhibit
+#define SNIFF_OVERFLOW      0x20    // RX FIFO overflowed, edges were lost
+
+typedef struct {
+    u32 t_us;           // First edge of the frame (or end of the inhibit)
+    u16 dur_us;         // First to last edge (inhibit: CLK low time)
+    u16 low_avg;        // Average CLK low in 0.1us units
+    u8 ch;
+    u8 flags;
+    u8 byte;
+    u8 bits;            // Edges seen
+} sniff_frame_t;
+
+typedef struct {
+    const char* name;
+    u8 data_pin;
+    PIO pio;
+    s8 sm;
+    u8 bits;
+    u16 shift;
+    bool h2d;
+    bool skip_ack;
+    u32 t_first;
+    u32 t_last;
+    u32 low_sum;
+    bool have_high;     // High-time word seen, rising edge word next
+    u32 high;
+    bool anchored;      // t_us/t_tenth follow the edges
+    u32 t_us;           // Time of the last rising edge
+    u8 t_tenth;
+} sniff_chan_t;
+
+static sniff_chan_t sniff_chans[] = {
+    { .name = "kb", .data_pin = PS2_KB_DATA_PIN, .sm = -1 },
+    { .name = "ms", .data_pin = PS2_MOUSE_DATA_PIN, .sm = -1 },
+};
+
+#define SNIFF_CHANS (sizeof(sniff_chans) / sizeof(sniff_chans[0]))
+
+static sniff_frame_t sniff_ring[SNIFF_RING_SIZE];
+static volatile u16 sniff_head = 0;
+static volatile u16 sniff_tail = 0;
+static u32 sniff_dropped = 0;
+static u32 sniff_overflows = 0;
+static s8 sniff_prg[2] = { -1, -1 };
+
+static void sniff_push(const sniff_frame_t* frame) {
+    u16 head = sniff_head;
+    u16 next = (head + 1) & (SNIFF_RING_SIZE - 1);
+
+    if (next == sniff_tail) {
+        sniff_dropped++;
+        return;
+    }
+
+    sniff_ring[head] = *frame;
+    sniff_head = next;
+}
+
+// Emit the frame in progress on a channel
+static void sniff_emit(u8 ch, u8 flags) {
+    sniff_chan_t* c = &sniff_chans[ch];
+    sniff_frame_t frame = {
+        .t_us = c->t_first,
+        .dur_us = c->t_last - c->t_first,
+        .low_avg = c->low_sum / c->bits,
+        .ch = ch,
+        .flags = flags | (c->h2d ? SNIFF_H2D : 0),
+        .byte = c->shift & 0xff,
+        .bits = c->bits
+    };
+
+    if (c->bits == 11) {
+        // Odd parity over data and parity bit, stop bit high
+        u16 ones = 0;
+        for (u8 i = 0; i < 9; i++) ones += c->shift >> i & 1;
+        if (!(ones & 1)) frame.flags |= SNIFF_PARITY_ERR;
+        if (!(c->shift >> 9 & 1)) frame.flags |= SNIFF_FRAMING_ERR;
+    } else {
+        frame.flags |= SNIFF_FRAMING_ERR;
+    }
+
+    sniff_push(&frame);
+    c->bits = 0;
+}
+
+// One CLK rising edge: DATA level and CLK low time in 0.1us units
+static void sniff_edge(u8 ch, bool data, u32 low, u32 now) {
+    sniff_chan_t* c = &sniff_chans[ch];
+
+    if (c->bits && now - c->t_last > SNIFF_IDLE_US) sniff_emit(ch, 0);
+
+    if (low >= SNIFF_INHIBIT_US * 10) {
+        if (c->bits) sniff_emit(ch, SNIFF_ABORTED | SNIFF_INHIBIT);
+        c->skip_ack = false;
+        c->t_last = now;
+
+        if (!data) {
+            // Request-to-send: this edge is the host's start bit
+            c->bits = 1;
+            c->shift = 0;
+            c->h2d = true;
+            c->t_first = now;
+            c->low_sum = 0;
+        } else {
+            sniff_frame_t frame = {
+                .t_us = now,
+                .dur_us = low / 10 > 0xffff ? 0xffff : low / 10,
+                .ch = ch,
+                .flags = SNIFF_INHIBIT
+            };
+            sniff_push(&frame);
+        }
+        return;
+    }
+
+    c->t_last = now;
+
+    if (!c->bits) {
+        // Device releases CLK and DATA together after its ACK clock
+        if (c->skip_ack) {
+            c->skip_ack = false;
+            return;
+        }
+
+        // Device-to-host frames start with a low start bit
+        if (data) return;
+        c->bits = 1;
+        c->shift = 0;
+        c->h2d = false;
+        c->t_first = now;
+        c->low_sum = low;
+        return;
+    }
+
+    // Data bits 0-7, parity, stop
+    c->shift |= (u16)data << (c->bits - 1);
+    c->low_sum += low;
+    c->bits++;
+
+    if (c->bits == 11) {
+        c->skip_ack = c->h2d;
+        sniff_emit(ch, 0);
+    }
+}
+
+// Time of a rising edge, from the previous one plus the period the SM
+// measured (in 0.1us units). Starts over from the interrupt time when
+// there is no previous edge to count from.
+static u32 sniff_edge_time(sniff_chan_t* c, u32 high, u32 low, u32 now) {
+    u32 edge = PS2SNIFF_EDGE_CYCLES / PS2SNIFF_LOOP_CYCLES;
+
+    if (!c->anchored || high == 0xffffffff || high > 0xffffffff - low - edge) {
+        c->anchored = true;
+        c->t_us = now;
+        c->t_tenth = 0;
+        return now;
+    }
+
+    u64 tenths = (u64)c->t_tenth + high + low + edge;
+    c->t_us += tenths / 10;
+    c->t_tenth = tenths % 10;
+
+    // Never ahead of the clock the edge was drained by
+    if ((s32)(c->t_us - now) > 0) c->t_us = now;
+    return c->t_us;
+}
+
+// The SM stalled on a full FIFO: edges were missed, so the frame in
+// progress is lost and the time chain must start over
+static void sniff_overflow(u8 ch, u32 now) {
+    sniff_chan_t* c = &sniff_chans[ch];
+
+    sniff_overflows++;
+    if (c->bits) sniff_emit(ch, SNIFF_ABORTED | SNIFF_OVERFLOW);
+    c->skip_ack = false;
+    c->anchored = false;
+
+    sniff_frame_t frame = { .t_us = now, .ch = ch, .flags = SNIFF_OVERFLOW };
+    sniff_push(&frame);
+}
+
+static void sniff_irq_handler(void) {
+    u32 now = time_us_32();
+
+    for (u8 ch = 0; ch < SNIFF_CHANS; ch++) {
+        sniff_chan_t* c = &sniff_chans[ch];
+        if (c->sm < 0) continue;
+
+        u32 stall = 1u << (PIO_FDEBUG_RXSTALL_LSB + c->sm);
+        bool overflow = c->pio->fdebug & stall;
+        if (overflow) c->pio->fdebug = stall;
+
+        while (!pio_sm_is_rx_fifo_empty(c->pio, c->sm)) {
+            u32 word = pio_sm_get(c->pio, c->sm);
+            if (!c->have_high) {
+                c->high = ~word;
+                c->have_high = true;
+                continue;
+            }
+            c->have_high = false;
+
+            u32 low = 0x7fffffff - (word & 0x7fffffff);
+            sniff_edge(ch, word >> 31, low, sniff_edge_time(c, c->high, low, now));
+        }
+
+        if (overflow) sniff_overflow(ch, now);
+    }
+}
+
+// Load the program on a PIO once and route its FIFO interrupts
+static bool sniff_add_program(PIO pio) {
+    u8 index = pio_get_index(pio);
+    if (sniff_prg[index] >= 0) return true;
+    if (!pio_can_add_program(pio, &ps2sniff_program)) return false;
+
+    sniff_prg[index] = pio_add_program(pio, &ps2sniff_program);
+    uint irq = index ? PIO1_IRQ_1 : PIO0_IRQ_1;
+    irq_add_shared_handler(irq, sniff_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(irq, true);
+    return true;
+}
+
+void ps2sniff_init(void) {
+    static const PIO pios[] = { pio0, pio1 };
+
+    // Counter loop is PS2SNIFF_LOOP_CYCLES per count
+    float div = (float)clock_get_hz(clk_sys) / ((float)SNIFF_COUNT_HZ * PS2SNIFF_LOOP_CYCLES);
+
+    // In channel order, so the keyboard gets the first free SM
+    for (u8 ch = 0; ch < SNIFF_CHANS; ch++) {
+        sniff_chan_t* c = &sniff_chans[ch];
+
+        for (u8 i = 0; i < 2 && c->sm < 0; i++) {
+            s8 sm = pio_claim_unused_sm(pios[i], false);
+            if (sm < 0) continue;
+            if (!sniff_add_program(pios[i])) {
+                pio_sm_unclaim(pios[i], sm);
+                continue;
+            }
+            c->pio = pios[i];
+            c->sm = sm;
+        }
+
+        if (c->sm < 0) {
+            printf("Analyzer: no free PIO SM and program space for %s\n", c->name);
+            continue;
+        }
+
+        u8 index = pio_get_index(c->pio);
+        ps2sniff_program_init(c->pio, c->sm, sniff_prg[index], c->data_pin, div);
+        pio_set_irq1_source_enabled(c->pio, pis_sm0_rx_fifo_not_empty + c->sm, true);
+        printf("Analyzer: %s on pio%d SM%d\n", c->name, index, c->sm);
+    }
+}
+
+void ps2sniff_dump(void) {
+    static u32 last_us[SNIFF_CHANS];
+
+    printf("Analyzer: %lu dropped, %lu FIFO overflows\n",
+           (unsigned long)sniff_dropped, (unsigned long)sniff_overflows);
+    printf("      t_us ch dir byte    gap_us  dur_us low_us flags\n");
+
+    while (sniff_tail != sniff_head) {
+        sniff_frame_t* f = &sniff_ring[sniff_tail];
+        u32 gap = f->t_us - last_us[f->ch];
+        last_us[f->ch] = f->t_us + f->dur_us;
+
+        if (f->flags == SNIFF_OVERFLOW) {
+            printf("%10lu %s  -   --  %8lu       -      - overflow\n",
+                   (unsigned long)f->t_us, sniff_chans[f->ch].name, (unsigned long)gap);
+        } else if (f->flags & SNIFF_INHIBIT && !(f->flags & SNIFF_ABORTED)) {
+            printf("%10lu %s  -   --  %8lu %7u      - inhibit\n",
+                   (unsigned long)f->t_us, sniff_chans[f->ch].name,
+                   (unsigned long)gap, f->dur_us);
+        } else {
+            printf("%10lu %s %s  %02X  %8lu %7u %3u.%u %s%s%s%s\n",
+                   (unsigned long)f->t_us, sniff_chans[f->ch].name,
+                   f->flags & SNIFF_H2D ? "H>D" : "D>H", f->byte,
+                   (unsigned long)gap, f->dur_us, f->low_avg / 10, f->low_avg % 10,
+                   f->flags & SNIFF_PARITY_ERR ? "parity " : "",
+                   f->flags & SNIFF_FRAMING_ERR ? "framing " : "",
+                   f->flags & SNIFF_ABORTED ? "aborted " : "",
+                   f->flags & SNIFF_OVERFLOW ? "overflow" : "");
+        }
+
+        sniff_tail = (sniff_tail + 1) & (SNIFF_RING_SIZE - 1);
+    }
+
+    sniff_dropped = 0;
+    sniff_overflows = 0;
+}
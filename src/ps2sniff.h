@@ -0,0 +1,23 @@
+/*
+ * Hecate - PS/2 Line Analyzer
+ *
+ * Public interface for the passive PS/2 line analyzer (PS2_ANALYZER builds).
+ * Records every frame on the keyboard and mouse lines into a RAM ring that
+ * is dumped over the debug UART.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PS2SNIFF_H
+#define PS2SNIFF_H
+
+#include "ps2out.h"
+
+// Start sniffing on spare PIO state machines (call after USB and PS/2 init, so
+// PIO-USB and the PS/2 ports have claimed their state machines first)
+void ps2sniff_init(void);
+
+// Print and consume everything recorded so far
+void ps2sniff_dump(void);
+
+#endif // PS2SNIFF_H
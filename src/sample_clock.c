@@ -0,0 +1,49 @@
+/*
+ * Hecate - Sample Clock
+ *
+ * Grid arithmetic for the mouse sample clock. ps2_mouse.c aims a
+ * hardware alarm at sample_clock.at, so a slot fires within interrupt
+ * latency of its ideal time rather than on the next timer wheel tick.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "sample_clock.h"
+
+void sample_clock_start(sample_clock* sc, uint64_t at) {
+    sc->at = at;
+    sc->frac = 0;
+    sc->adj = 0;
+}
+
+void sample_clock_next(sample_clock* sc, uint8_t rate, uint64_t now) {
+    sc->at += 1000000 / rate + sc->adj;
+    sc->frac += 1000000 % rate;
+    while (sc->frac >= rate) {
+        sc->frac -= rate;
+        sc->at++;
+    }
+
+    if (sc->at <= now) {
+        sc->at = now + 1000000 / rate;
+        sc->frac = 0;
+    }
+}
+
+void sample_clock_lock(sample_clock* sc, uint8_t rate, uint32_t report_last,
+                       uint32_t report_interval, uint32_t lead_us) {
+    uint32_t period = 1000000 / rate;
+
+    // Faster polling always has a fresh report within one USB interval
+    // of the slot anyway, and differing cadences cannot lock
+    sc->adj = 0;
+    if (report_interval < period - period / 8 || report_interval > period + period / 8) return;
+
+    uint32_t lead = (uint32_t)sc->at - report_last;
+    if (lead >= period) return;
+
+    int32_t adj = -((int32_t)lead - (int32_t)lead_us) / 4;
+    if (adj > SC_PHASE_STEP_US) adj = SC_PHASE_STEP_US;
+    if (adj < -SC_PHASE_STEP_US) adj = -SC_PHASE_STEP_US;
+    sc->adj = adj;
+}
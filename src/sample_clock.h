@@ -0,0 +1,40 @@
+/*
+ * Hecate - Sample Clock
+ *
+ * Absolute sample grid for the PS/2 mouse stream. Slot n is at
+ * start + n * 1e6 / rate, with the division remainder carried so the rate
+ * never drifts, plus a bounded phase correction per slot. Plain
+ * arithmetic on times the caller supplies: no hardware access, so it
+ * also builds for the host tests.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <stdint.h>
+
+// Largest phase correction applied to one slot
+#define SC_PHASE_STEP_US 250
+
+typedef struct {
+    uint64_t at;                // Ideal time of the next slot
+    uint16_t frac;              // Sub-microsecond part of at, in 1/rate
+    int32_t adj;                // Correction applied to the next slot
+} sample_clock;
+
+// First slot at an absolute time
+void sample_clock_start(sample_clock* sc, uint64_t at);
+
+// Advance to the slot after now. A clock that fell a whole slot behind
+// restarts its grid from now instead of catching up in a burst.
+void sample_clock_next(sample_clock* sc, uint8_t rate, uint64_t now);
+
+// Phase lock to a report source. When reports arrive at the sample
+// period, the next slot is pulled towards lead_us after the newest one,
+// by a quarter of the error and at most SC_PHASE_STEP_US.
+void sample_clock_lock(sample_clock* sc, uint8_t rate, uint32_t report_last,
+                       uint32_t report_interval, uint32_t lead_us);
+
+#endif // SAMPLE_CLOCK_H
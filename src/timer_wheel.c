@@ -0,0 +1,216 @@
+/*
+ * Hecate - Timer Wheel
+ *
+ * Hashed timer wheel for the PS/2 side: reset/BAT delays and the ps2out
+ * line retry run from here instead of allocating SDK alarms per event, so
+ * a host hammering reset or enable cannot exhaust the alarm pool. Periodic
+ * timing that must not be quantised to a tick (typematic, the mouse sample
+ * clock) uses deadlines on the same alarm, so all PS/2 timing costs one
+ * of the RP2040's four hardware alarms.
+ *
+ * Design:
+ *   - TW_SLOTS list heads, one per tick modulo the wheel size
+ *   - A timer sits in the slot of its absolute due tick; delays longer
+ *     than a turn just stay in the slot until their tick comes round
+ *   - Intrusive doubly linked lists, so arm and cancel are O(1)
+ *   - One claimed hardware alarm, always aimed at the earliest of the
+ *     next tick (every TW_TICK_US while any timer is armed) and the
+ *     registered deadlines; cancelled when there is neither (no idle
+ *     interrupts for power.c)
+ *
+ * Statistics: a late firing is a callback run a full tick or more after
+ * its due tick; an overrun is a tick the interrupt had to catch up on
+ * because it ran more than a tick behind.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "timer_wheel.h"
+#include "ps2out.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include <stdio.h>
+
+// Wheel size, power of two (64ms per turn at 250us ticks)
+#define TW_SLOTS 256
+
+static tw_timer* tw_slots[TW_SLOTS];
+static int tw_alarm = -1;
+static bool tw_running = false;
+static u32 tw_tick = 0;             // Last tick processed
+static u64 tw_tick_us = 0;          // Time tw_tick was due
+static u32 tw_count = 0;            // Armed timers
+static tw_deadline* tw_deadlines = NULL;
+static bool tw_in_irq = false;      // Interrupt reprograms the alarm on exit
+
+// Statistics
+static u32 tw_fired = 0;
+static u32 tw_late = 0;
+static u32 tw_late_max_us = 0;
+static u32 tw_overruns = 0;
+
+static void tw_link(tw_timer* t, u32 due) {
+    tw_timer** head = &tw_slots[due & (TW_SLOTS - 1)];
+
+    t->due = due;
+    t->prev = NULL;
+    t->next = *head;
+    if (*head) (*head)->prev = t;
+    *head = t;
+    t->armed = true;
+    tw_count++;
+}
+
+static void tw_unlink(tw_timer* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        tw_slots[t->due & (TW_SLOTS - 1)] = t->next;
+    }
+    if (t->next) t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    t->armed = false;
+    tw_count--;
+}
+
+// Ticks from tw_tick covering us, at least one
+static u32 tw_ticks(u64 us) {
+    u64 ticks = (us + TW_TICK_US - 1) / TW_TICK_US;
+    return ticks ? ticks : 1;
+}
+
+// Aim the alarm at the next tick or deadline, whichever is first
+// (interrupts disabled)
+static void tw_schedule(void) {
+    u64 next = tw_running ? tw_tick_us + TW_TICK_US : TW_NEVER;
+
+    for (tw_deadline* d = tw_deadlines; d; d = d->next) {
+        if (d->at < next) next = d->at;
+    }
+
+    if (next == TW_NEVER) {
+        hardware_alarm_cancel(tw_alarm);
+    } else if (hardware_alarm_set_target(tw_alarm, from_us_since_boot(next))) {
+        // Already due
+        hardware_alarm_force_irq(tw_alarm);
+    }
+}
+
+// Fire everything due on one tick. Timers are taken one at a time from
+// the head of the scan, so callbacks may arm or cancel any timer.
+static void tw_run_tick(u64 now) {
+    for (;;) {
+        tw_timer* t = tw_slots[tw_tick & (TW_SLOTS - 1)];
+        while (t && t->due != tw_tick) t = t->next;
+        if (!t) return;
+
+        tw_unlink(t);
+
+        u32 late = now - tw_tick_us;
+        if (late >= TW_TICK_US) {
+            tw_late++;
+            if (late > tw_late_max_us) tw_late_max_us = late;
+        }
+        tw_fired++;
+
+        u32 us = t->fn(t->ctx);
+
+        // Periodic: next run counted from this due tick, not from now
+        if (us && !t->armed) tw_link(t, tw_tick + tw_ticks(us));
+    }
+}
+
+static void tw_irq(uint alarm) {
+    (void)alarm;
+    u64 now = time_us_64();
+    bool caught_up = false;
+
+    tw_in_irq = true;
+
+    while (tw_running && tw_tick_us + TW_TICK_US <= now) {
+        if (caught_up) tw_overruns++;
+        caught_up = true;
+
+        tw_tick++;
+        tw_tick_us += TW_TICK_US;
+        tw_run_tick(now);
+    }
+    if (!tw_count) tw_running = false;
+
+    // Deadlines fire once; the callback aims the next one
+    for (tw_deadline* d = tw_deadlines; d; d = d->next) {
+        if (d->at > now) continue;
+        d->at = TW_NEVER;
+        d->fn(now);
+    }
+
+    tw_in_irq = false;
+    tw_schedule();
+}
+
+void tw_init(void) {
+    tw_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(tw_alarm, tw_irq);
+}
+
+void tw_timer_init(tw_timer* t, tw_callback fn, void* ctx) {
+    t->next = t->prev = NULL;
+    t->fn = fn;
+    t->ctx = ctx;
+    t->due = 0;
+    t->armed = false;
+}
+
+void tw_arm(tw_timer* t, u32 us) {
+    u32 status = save_and_disable_interrupts();
+    u64 now = time_us_64();
+
+    if (t->armed) tw_unlink(t);
+
+    // Restart the tick grid from now when the wheel was stopped
+    if (!tw_running) {
+        tw_tick_us = now;
+        tw_running = true;
+        tw_schedule();
+    }
+
+    tw_link(t, tw_tick + tw_ticks(now - tw_tick_us + us));
+    restore_interrupts(status);
+}
+
+void tw_cancel(tw_timer* t) {
+    u32 status = save_and_disable_interrupts();
+    if (t->armed) tw_unlink(t);
+    restore_interrupts(status);
+}
+
+void tw_deadline_init(tw_deadline* d, tw_deadline_fn fn) {
+    u32 status = save_and_disable_interrupts();
+    d->fn = fn;
+    d->at = TW_NEVER;
+    d->next = tw_deadlines;
+    tw_deadlines = d;
+    restore_interrupts(status);
+}
+
+void tw_set(tw_deadline* d, u64 at) {
+    u32 status = save_and_disable_interrupts();
+    d->at = at;
+    if (!tw_in_irq) tw_schedule();
+    restore_interrupts(status);
+}
+
+void tw_print_stats(void) {
+    printf("Timers: %lu armed, %lu fired, %lu late (worst %lu us), %lu tick overruns\n",
+           (unsigned long)tw_count, (unsigned long)tw_fired, (unsigned long)tw_late,
+           (unsigned long)tw_late_max_us, (unsigned long)tw_overruns);
+}
+
+void tw_reset_stats(void) {
+    u32 status = save_and_disable_interrupts();
+    tw_fired = 0;
+    tw_late = 0;
+    tw_late_max_us = 0;
+    tw_overruns = 0;
+    restore_interrupts(status);
+}
@@ -0,0 +1,77 @@
+/*
+ * Hecate - Timer Wheel
+ *
+ * Public interface for the shared PS/2 timer wheel. Timers are owned and
+ * statically allocated by each subsystem; arming and cancelling are O(1)
+ * and safe from any context. Callbacks run from the wheel's hardware
+ * alarm interrupt. Deadlines share that alarm for timing that must not
+ * be quantised to a tick.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Tick length; timers fire on the first tick at or after their delay
+#define TW_TICK_US   250
+
+// Called from the wheel interrupt. Return the delay in microseconds to the
+// next run (measured from when this run was due, so periods do not drift),
+// or 0 to stop.
+typedef uint32_t (*tw_callback)(void* ctx);
+
+typedef struct tw_timer {
+    struct tw_timer* next;
+    struct tw_timer* prev;
+    tw_callback fn;
+    void* ctx;
+    uint32_t due;               // Absolute tick the timer fires on
+    bool armed;
+} tw_timer;
+
+// Exact deadline on the wheel's alarm, for periodic timing that must hit
+// its target to the microsecond (typematic, the mouse sample clock). The
+// callback runs from the wheel interrupt once the deadline has passed,
+// with the current time; the owner aims the next one with tw_set().
+#define TW_NEVER UINT64_MAX
+
+typedef void (*tw_deadline_fn)(uint64_t now);
+
+typedef struct tw_deadline {
+    struct tw_deadline* next;
+    tw_deadline_fn fn;
+    uint64_t at;                // Absolute time in us, TW_NEVER when idle
+} tw_deadline;
+
+// Claim the hardware alarm (call before any timer is armed)
+void tw_init(void);
+
+// Bind a callback to a timer (does not arm it)
+void tw_timer_init(tw_timer* t, tw_callback fn, void* ctx);
+
+// (Re)arm a timer to fire after at least us microseconds
+void tw_arm(tw_timer* t, uint32_t us);
+
+// Disarm a timer; harmless if it is not armed
+void tw_cancel(tw_timer* t);
+
+static inline bool tw_armed(const tw_timer* t) {
+    return t->armed;
+}
+
+// Register a deadline with the wheel, idle (call once at init)
+void tw_deadline_init(tw_deadline* d, tw_deadline_fn fn);
+
+// Aim a deadline at an absolute time_us_64() value, or TW_NEVER to stop
+// it. A time already past fires on the next interrupt.
+void tw_set(tw_deadline* d, uint64_t at);
+
+// Print / clear wheel statistics (late firings, tick overruns)
+void tw_print_stats(void);
+void tw_reset_stats(void);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,457 @@
+/*
+ * Hecate - PIO Interpreter for Host Tests
+ *
+ * Instruction semantics follow the RP2040 datasheet, chapter 3.4:
+ *   - side-set is applied when an instruction issues, even if it stalls
+ *   - the delay runs after the instruction completes, never while stalled
+ *   - autopull refills an empty OSR in the background, so 'jmp !osre'
+ *     sees a frame as soon as it is in the TX FIFO
+ *   - 'irq wait' raises its flag and stalls until something clears it
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pio_sim.h"
+#include <string.h>
+
+void pio_sim_reset(PIO pio) {
+    memset(pio, 0, sizeof(*pio));
+}
+
+bool pio_sim_pin(PIO pio, uint pin) {
+    bool driven_low = pio->pindir[pin] && !pio->out[pin];
+    return !driven_low && !pio->ext_low[pin];
+}
+
+// ----------------------------------------------------------------------------
+// SDK configuration calls
+// ----------------------------------------------------------------------------
+
+pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c = { 0 };
+    c.wrap = 31;
+    c.out_right = true;
+    c.in_right = true;
+    c.pull_thresh = 32;
+    c.push_thresh = 32;
+    c.div = 1.0f;
+    return c;
+}
+
+void sm_config_set_wrap(pio_sm_config* c, uint wrap_target, uint wrap) {
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+void sm_config_set_sideset(pio_sm_config* c, uint bit_count, bool optional, bool pindirs) {
+    c->side_bits = bit_count;
+    c->side_opt = optional;
+    c->side_pindirs = pindirs;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config* c, uint base) {
+    c->sideset_base = base;
+}
+
+void sm_config_set_set_pins(pio_sm_config* c, uint base, uint count) {
+    c->set_base = base;
+    c->set_count = count;
+}
+
+void sm_config_set_out_pins(pio_sm_config* c, uint base, uint count) {
+    c->out_base = base;
+    c->out_count = count;
+}
+
+void sm_config_set_in_pins(pio_sm_config* c, uint base) {
+    c->in_base = base;
+}
+
+void sm_config_set_jmp_pin(pio_sm_config* c, uint pin) {
+    c->jmp_pin = pin;
+}
+
+void sm_config_set_out_shift(pio_sm_config* c, bool shift_right, bool autopull, uint threshold) {
+    c->out_right = shift_right;
+    c->autopull = autopull;
+    c->pull_thresh = threshold ? threshold : 32;
+}
+
+void sm_config_set_in_shift(pio_sm_config* c, bool shift_right, bool autopush, uint threshold) {
+    c->in_right = shift_right;
+    c->autopush = autopush;
+    c->push_thresh = threshold ? threshold : 32;
+}
+
+void sm_config_set_fifo_join(pio_sm_config* c, enum pio_fifo_join join) {
+    c->fifo_join = join;
+}
+
+void sm_config_set_clkdiv(pio_sm_config* c, float div) {
+    c->div = div;
+}
+
+// Load at the top of free memory, relocating JMP targets like the SDK
+uint pio_add_program(PIO pio, const pio_program_t* program) {
+    uint offset = 32 - pio->used - program->length;
+
+    for (uint i = 0; i < program->length; i++) {
+        uint16_t instr = program->instructions[i];
+        if ((instr & 0xe000) == 0x0000) instr += offset;
+        pio->mem[offset + i] = instr;
+    }
+    pio->used += program->length;
+    return offset;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config* c) {
+    pio_sim_sm* s = &pio->sm[sm];
+
+    memset(s, 0, sizeof(*s));
+    s->cfg = *c;
+    s->pc = initial_pc;
+    s->osr_count = 32;          // OSR starts empty
+
+    // The divider register holds 16.8 fixed point, as the SDK rounds it
+    uint32_t div_int = (uint32_t)c->div;
+    uint32_t div_frac = (uint32_t)((c->div - div_int) * 256);
+    s->div256 = div_int * 256 + div_frac;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    pio->sm[sm].enabled = enabled;
+}
+
+void pio_gpio_init(PIO pio, uint pin) {
+    (void)pio;
+    (void)pin;
+}
+
+void gpio_pull_up(uint pin) {
+    (void)pin;
+}
+
+// ----------------------------------------------------------------------------
+// FIFOs
+// ----------------------------------------------------------------------------
+
+static uint8_t tx_depth(const pio_sim_sm* s) {
+    return s->cfg.fifo_join == PIO_FIFO_JOIN_TX ? 8 : s->cfg.fifo_join == PIO_FIFO_JOIN_RX ? 0 : 4;
+}
+
+static uint8_t rx_depth(const pio_sim_sm* s) {
+    return s->cfg.fifo_join == PIO_FIFO_JOIN_RX ? 8 : s->cfg.fifo_join == PIO_FIFO_JOIN_TX ? 0 : 4;
+}
+
+bool pio_sim_put(PIO pio, uint sm, uint32_t data) {
+    pio_sim_sm* s = &pio->sm[sm];
+    if (s->tx_n >= tx_depth(s)) return false;
+    s->tx[s->tx_n++] = data;
+    return true;
+}
+
+static uint32_t fifo_pop(uint32_t* fifo, uint8_t* n) {
+    uint32_t data = fifo[0];
+    memmove(fifo, fifo + 1, (*n - 1) * sizeof(*fifo));
+    (*n)--;
+    return data;
+}
+
+bool pio_sim_get(PIO pio, uint sm, uint32_t* data) {
+    pio_sim_sm* s = &pio->sm[sm];
+    if (!s->rx_n) return false;
+    *data = fifo_pop(s->rx, &s->rx_n);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Execution
+// ----------------------------------------------------------------------------
+
+static uint32_t mask(uint bits) {
+    return bits >= 32 ? 0xffffffff : (1u << bits) - 1;
+}
+
+static void write_pins(PIO pio, uint base, uint count, uint32_t value, bool dirs) {
+    for (uint i = 0; i < count; i++) {
+        uint pin = (base + i) % PIO_SIM_PINS;
+        if (dirs) {
+            pio->pindir[pin] = value >> i & 1;
+        } else {
+            pio->out[pin] = value >> i & 1;
+        }
+    }
+}
+
+static uint32_t read_pins(PIO pio, uint base, uint count) {
+    uint32_t value = 0;
+    for (uint i = 0; i < count; i++) {
+        value |= (uint32_t)pio_sim_pin(pio, (base + i) % PIO_SIM_PINS) << i;
+    }
+    return value;
+}
+
+static uint irq_index(uint sm, uint index) {
+    if (!(index & 0x10)) return index & 7;
+    return (index & 4) | ((index + sm) & 3);
+}
+
+static void autopull(pio_sim_sm* s) {
+    if (s->cfg.autopull && s->osr_count >= s->cfg.pull_thresh && s->tx_n) {
+        s->osr = fifo_pop(s->tx, &s->tx_n);
+        s->osr_count = 0;
+    }
+}
+
+static uint32_t shift_out(pio_sim_sm* s, uint bits) {
+    uint32_t data;
+    if (s->cfg.out_right) {
+        data = s->osr & mask(bits);
+        s->osr = bits >= 32 ? 0 : s->osr >> bits;
+    } else {
+        data = bits >= 32 ? s->osr : s->osr >> (32 - bits);
+        s->osr = bits >= 32 ? 0 : s->osr << bits;
+    }
+    s->osr_count = s->osr_count + bits > 32 ? 32 : s->osr_count + bits;
+    return data;
+}
+
+static void shift_in(pio_sim_sm* s, uint32_t data, uint bits) {
+    data &= mask(bits);
+    if (bits >= 32) {
+        s->isr = data;
+    } else if (s->cfg.in_right) {
+        s->isr = s->isr >> bits | data << (32 - bits);
+    } else {
+        s->isr = s->isr << bits | data;
+    }
+    s->isr_count = s->isr_count + bits > 32 ? 32 : s->isr_count + bits;
+}
+
+static uint32_t mov_source(PIO pio, pio_sim_sm* s, uint src) {
+    switch (src) {
+        case 0: return read_pins(pio, s->cfg.in_base, 32);
+        case 1: return s->x;
+        case 2: return s->y;
+        case 6: return s->isr;
+        case 7: return s->osr;
+        default: return 0;          // null, status (unused)
+    }
+}
+
+static uint32_t bit_reverse(uint32_t v) {
+    uint32_t r = 0;
+    for (uint i = 0; i < 32; i++) r |= (v >> i & 1) << (31 - i);
+    return r;
+}
+
+// Execute one SM cycle. Returns with pc and delay updated.
+static void sm_cycle(PIO pio, uint sm) {
+    pio_sim_sm* s = &pio->sm[sm];
+    s->cycles++;
+
+    autopull(s);
+    if (s->delay) {
+        s->delay--;
+        return;
+    }
+
+    uint16_t instr = pio->mem[s->pc];
+    uint op = instr >> 13;
+    uint arg1 = instr >> 5 & 7;
+    uint arg2 = instr & 0x1f;
+
+    // Delay / side-set field
+    uint field = instr >> 8 & 0x1f;
+    uint side_bits = s->cfg.side_bits;
+    uint delay = field & mask(5 - side_bits);
+    if (side_bits) {
+        uint side = field >> (5 - side_bits);
+        bool apply = true;
+        if (s->cfg.side_opt) {
+            apply = side >> (side_bits - 1) & 1;
+            side &= mask(side_bits - 1);
+        }
+        uint count = side_bits - s->cfg.side_opt;
+        if (apply) write_pins(pio, s->cfg.sideset_base, count, side, s->cfg.side_pindirs);
+    }
+
+    bool stall = false;
+    bool jumped = false;
+
+    switch (op) {
+        case 0: {   // JMP
+            bool take;
+            switch (arg1) {
+                case 0: take = true; break;
+                case 1: take = s->x == 0; break;
+                case 2: take = s->x != 0; s->x--; break;
+                case 3: take = s->y == 0; break;
+                case 4: take = s->y != 0; s->y--; break;
+                case 5: take = s->x != s->y; break;
+                case 6: take = pio_sim_pin(pio, s->cfg.jmp_pin); break;
+                default: take = s->osr_count < s->cfg.pull_thresh; break;
+            }
+            if (take) {
+                s->pc = arg2;
+                jumped = true;
+            }
+            break;
+        }
+
+        case 1: {   // WAIT
+            bool polarity = instr >> 7 & 1;
+            uint src = instr >> 5 & 3;
+            bool level;
+            if (src == 0) {
+                level = pio_sim_pin(pio, arg2);
+            } else if (src == 1) {
+                level = pio_sim_pin(pio, (s->cfg.in_base + arg2) % PIO_SIM_PINS);
+            } else {
+                uint n = irq_index(sm, arg2);
+                level = pio->irq >> n & 1;
+                if (level && polarity) pio->irq &= ~(1u << n);
+            }
+            stall = level != polarity;
+            break;
+        }
+
+        case 2: {   // IN
+            uint bits = arg2 ? arg2 : 32;
+            if (s->cfg.autopush && s->isr_count + bits >= s->cfg.push_thresh &&
+                s->rx_n >= rx_depth(s)) {
+                stall = true;
+                break;
+            }
+            uint32_t data;
+            switch (arg1) {
+                case 0: data = read_pins(pio, s->cfg.in_base, bits); break;
+                case 1: data = s->x; break;
+                case 2: data = s->y; break;
+                case 6: data = s->isr; break;
+                case 7: data = s->osr; break;
+                default: data = 0; break;
+            }
+            shift_in(s, data, bits);
+            if (s->cfg.autopush && s->isr_count >= s->cfg.push_thresh) {
+                s->rx[s->rx_n++] = s->isr;
+                s->isr = 0;
+                s->isr_count = 0;
+            }
+            break;
+        }
+
+        case 3: {   // OUT
+            uint bits = arg2 ? arg2 : 32;
+            if (s->cfg.autopull && s->osr_count >= s->cfg.pull_thresh) {
+                if (!s->tx_n) {
+                    stall = true;
+                    break;
+                }
+                autopull(s);
+            }
+            uint32_t data = shift_out(s, bits);
+            switch (arg1) {
+                case 0: write_pins(pio, s->cfg.out_base, s->cfg.out_count, data, false); break;
+                case 1: s->x = data; break;
+                case 2: s->y = data; break;
+                case 4: write_pins(pio, s->cfg.out_base, s->cfg.out_count, data, true); break;
+                case 5: s->pc = data & 0x1f; jumped = true; break;
+                case 6: s->isr = data; s->isr_count = bits; break;
+                default: break;     // null
+            }
+            break;
+        }
+
+        case 4: {   // PUSH / PULL
+            bool pull = instr >> 7 & 1;
+            bool block = instr >> 5 & 1;
+            if (pull) {
+                if (s->tx_n) {
+                    s->osr = fifo_pop(s->tx, &s->tx_n);
+                    s->osr_count = 0;
+                } else if (block) {
+                    stall = true;
+                } else {
+                    s->osr = s->x;
+                    s->osr_count = 0;
+                }
+            } else if (s->rx_n < rx_depth(s)) {
+                s->rx[s->rx_n++] = s->isr;
+                s->isr = 0;
+                s->isr_count = 0;
+            } else {
+                stall = block;
+            }
+            break;
+        }
+
+        case 5: {   // MOV
+            uint32_t data = mov_source(pio, s, instr & 7);
+            uint mov_op = instr >> 3 & 3;
+            if (mov_op == 1) data = ~data;
+            if (mov_op == 2) data = bit_reverse(data);
+            switch (arg1) {
+                case 0: write_pins(pio, s->cfg.out_base, s->cfg.out_count, data, false); break;
+                case 1: s->x = data; break;
+                case 2: s->y = data; break;
+                case 5: s->pc = data & 0x1f; jumped = true; break;
+                case 6: s->isr = data; s->isr_count = 0; break;
+                case 7: s->osr = data; s->osr_count = 0; break;
+                default: break;
+            }
+            break;
+        }
+
+        case 6: {   // IRQ
+            bool clear = instr >> 6 & 1;
+            bool wait = instr >> 5 & 1;
+            uint n = irq_index(sm, arg2);
+            if (clear) {
+                pio->irq &= ~(1u << n);
+            } else if (s->irq_waiting) {
+                stall = pio->irq >> n & 1;
+                if (!stall) s->irq_waiting = false;
+            } else {
+                pio->irq |= 1u << n;
+                if (wait) {
+                    s->irq_waiting = true;
+                    stall = true;
+                }
+            }
+            break;
+        }
+
+        default: {  // SET
+            switch (arg1) {
+                case 0: write_pins(pio, s->cfg.set_base, s->cfg.set_count, arg2, false); break;
+                case 1: s->x = arg2; break;
+                case 2: s->y = arg2; break;
+                case 4: write_pins(pio, s->cfg.set_base, s->cfg.set_count, arg2, true); break;
+                default: break;
+            }
+            break;
+        }
+    }
+
+    if (stall) return;
+
+    s->delay = delay;
+    if (!jumped) s->pc = s->pc == s->cfg.wrap ? s->cfg.wrap_target : s->pc + 1u;
+}
+
+void pio_sim_tick(PIO pio) {
+    pio->now++;
+
+    for (uint sm = 0; sm < 4; sm++) {
+        pio_sim_sm* s = &pio->sm[sm];
+        if (!s->enabled) continue;
+
+        // Fractional divider: one SM cycle per div system cycles on average
+        s->div_acc += 256;
+        if (s->div_acc >= s->div256) {
+            s->div_acc -= s->div256;
+            sm_cycle(pio, sm);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * Hecate - PIO Interpreter for Host Tests
+ *
+ * Cycle-level model of one PIO block running a pioasm-generated program
+ * against simulated open-drain GPIOs. Covers what the firmware's
+ * programs use: side-set (pins or pindirs, optional), delays, SET, OUT
+ * and IN with autopull/autopush, MOV, WAIT on pins, IRQ (rel, wait) and
+ * every JMP condition. The SDK configuration calls in
+ * stubs/hardware/pio.h land here, so a program is set up by the same
+ * *_program_init() the firmware calls.
+ *
+ * Time runs in system clock cycles; each SM executes on the cycles its
+ * fractional clock divider enables, as on the chip.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PIO_SIM_H
+#define PIO_SIM_H
+
+#include "hardware/pio.h"
+
+#define PIO_SIM_PINS 32
+
+typedef struct {
+    pio_sm_config cfg;
+    bool enabled;
+    uint8_t pc;
+    uint8_t delay;
+    bool irq_waiting;           // 'irq wait' raised its flag, stalled on it
+    uint32_t x, y;
+    uint32_t isr, osr;
+    uint8_t isr_count, osr_count;
+    uint32_t tx[8], rx[8];
+    uint8_t tx_n, rx_n;
+    uint32_t div256;            // Clock divider in 1/256
+    uint64_t div_acc;           // Divider accumulator, 1/256 cycles
+    uint64_t cycles;            // SM cycles executed
+} pio_sim_sm;
+
+struct pio_sim {
+    uint16_t mem[32];
+    uint8_t used;               // Instruction slots taken
+    uint8_t irq;                // IRQ flags 0-7
+    pio_sim_sm sm[4];
+    bool pindir[PIO_SIM_PINS];  // Output enable per GPIO
+    bool out[PIO_SIM_PINS];     // Output level per GPIO
+    bool ext_low[PIO_SIM_PINS]; // Another device pulls the line low
+    uint64_t now;               // System clock cycles
+};
+
+// Pristine block, nothing loaded
+void pio_sim_reset(PIO pio);
+
+// Line level: pulled up unless the PIO or the other side drives it low
+bool pio_sim_pin(PIO pio, uint pin);
+
+// Advance one system clock cycle
+void pio_sim_tick(PIO pio);
+
+// FIFO access as pio_sm_put / pio_sm_get; false when full / empty
+bool pio_sim_put(PIO pio, uint sm, uint32_t data);
+bool pio_sim_get(PIO pio, uint sm, uint32_t* data);
+
+#endif // PIO_SIM_H
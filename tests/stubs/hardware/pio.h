@@ -0,0 +1,67 @@
+// Host test stand-in for the Pico SDK PIO API. Enough of it for firmware
+// headers and the pioasm-generated program headers to compile; the
+// functions are implemented by the PIO interpreter in tests/pio_sim.c,
+// which only the PIO tests link.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+typedef struct pio_sim* PIO;
+
+typedef struct {
+    uint wrap_target;
+    uint wrap;
+    uint side_bits;             // Including the enable bit when optional
+    bool side_opt;
+    bool side_pindirs;
+    uint sideset_base;
+    uint set_base;
+    uint set_count;
+    uint out_base;
+    uint out_count;
+    uint in_base;
+    uint jmp_pin;
+    bool out_right;
+    bool autopull;
+    uint pull_thresh;
+    bool in_right;
+    bool autopush;
+    uint push_thresh;
+    int fifo_join;
+    float div;
+} pio_sm_config;
+
+typedef struct pio_program {
+    const uint16_t* instructions;
+    uint8_t length;
+    int8_t origin;
+    uint8_t pio_version;
+} pio_program_t;
+
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config* c, uint wrap_target, uint wrap);
+void sm_config_set_sideset(pio_sm_config* c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config* c, uint base);
+void sm_config_set_set_pins(pio_sm_config* c, uint base, uint count);
+void sm_config_set_out_pins(pio_sm_config* c, uint base, uint count);
+void sm_config_set_in_pins(pio_sm_config* c, uint base);
+void sm_config_set_jmp_pin(pio_sm_config* c, uint pin);
+void sm_config_set_out_shift(pio_sm_config* c, bool shift_right, bool autopull, uint threshold);
+void sm_config_set_in_shift(pio_sm_config* c, bool shift_right, bool autopush, uint threshold);
+void sm_config_set_fifo_join(pio_sm_config* c, enum pio_fifo_join join);
+void sm_config_set_clkdiv(pio_sm_config* c, float div);
+
+uint pio_add_program(PIO pio, const pio_program_t* program);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config* c);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_gpio_init(PIO pio, uint pin);
+void gpio_pull_up(uint pin);
@@ -0,0 +1,3 @@
+// Host test stand-in for the Pico SDK header: firmware headers include
+// it, the code under test uses nothing from it
+#pragma once
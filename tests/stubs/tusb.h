@@ -0,0 +1,70 @@
+// Host test stand-in for TinyUSB: the HID usages the firmware's key
+// tables refer to, with TinyUSB's values
+#pragma once
+
+#define HID_KEY_A               0x04
+#define HID_KEY_H               0x0B
+#define HID_KEY_I               0x0C
+#define HID_KEY_J               0x0D
+#define HID_KEY_K               0x0E
+#define HID_KEY_L               0x0F
+#define HID_KEY_O               0x12
+#define HID_KEY_P               0x13
+#define HID_KEY_U               0x18
+#define HID_KEY_Y               0x1C
+#define HID_KEY_1               0x1E
+#define HID_KEY_2               0x1F
+#define HID_KEY_3               0x20
+#define HID_KEY_4               0x21
+#define HID_KEY_5               0x22
+#define HID_KEY_6               0x23
+#define HID_KEY_7               0x24
+#define HID_KEY_8               0x25
+#define HID_KEY_9               0x26
+#define HID_KEY_0               0x27
+#define HID_KEY_BACKSPACE       0x2A
+#define HID_KEY_MINUS           0x2D
+#define HID_KEY_EQUAL           0x2E
+#define HID_KEY_CAPS_LOCK       0x39
+#define HID_KEY_F1              0x3A
+#define HID_KEY_F2              0x3B
+#define HID_KEY_F3              0x3C
+#define HID_KEY_F4              0x3D
+#define HID_KEY_F5              0x3E
+#define HID_KEY_F6              0x3F
+#define HID_KEY_F7              0x40
+#define HID_KEY_F8              0x41
+#define HID_KEY_F9              0x42
+#define HID_KEY_F10             0x43
+#define HID_KEY_F11             0x44
+#define HID_KEY_F12             0x45
+#define HID_KEY_INSERT          0x49
+#define HID_KEY_HOME            0x4A
+#define HID_KEY_PAGE_UP         0x4B
+#define HID_KEY_DELETE          0x4C
+#define HID_KEY_END             0x4D
+#define HID_KEY_PAGE_DOWN       0x4E
+#define HID_KEY_ARROW_RIGHT     0x4F
+#define HID_KEY_ARROW_LEFT      0x50
+#define HID_KEY_ARROW_DOWN      0x51
+#define HID_KEY_ARROW_UP        0x52
+#define HID_KEY_MUTE            0x7F
+#define HID_KEY_VOLUME_UP       0x80
+#define HID_KEY_VOLUME_DOWN     0x81
+#define HID_KEY_CONTROL_LEFT    0xE0
+#define HID_KEY_SHIFT_LEFT      0xE1
+#define HID_KEY_ALT_LEFT        0xE2
+#define HID_KEY_GUI_LEFT        0xE3
+#define HID_KEY_CONTROL_RIGHT   0xE4
+#define HID_KEY_SHIFT_RIGHT     0xE5
+#define HID_KEY_ALT_RIGHT       0xE6
+#define HID_KEY_GUI_RIGHT       0xE7
+
+#define KEYBOARD_MODIFIER_LEFTCTRL   0x01
+#define KEYBOARD_MODIFIER_LEFTSHIFT  0x02
+#define KEYBOARD_MODIFIER_LEFTALT    0x04
+#define KEYBOARD_MODIFIER_LEFTGUI    0x08
+#define KEYBOARD_MODIFIER_RIGHTCTRL  0x10
+#define KEYBOARD_MODIFIER_RIGHTSHIFT 0x20
+#define KEYBOARD_MODIFIER_RIGHTALT   0x40
+#define KEYBOARD_MODIFIER_RIGHTGUI   0x80
@@ -0,0 +1,32 @@
+/*
+ * Hecate - Host Test Helpers
+ *
+ * Minimal checks for the host-built tests: a failed CHECK prints where
+ * and why and the test carries on, test_result() turns the count into
+ * the exit status ctest looks at.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+    if (!(cond)) {                                              \
+        printf("%s:%d: ", __FILE__, __LINE__);                  \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        test_failures++;                                        \
+    }                                                           \
+} while (0)
+
+static inline int test_result(const char* name) {
+    printf("%s: %s (%d failures)\n", name, test_failures ? "FAIL" : "ok", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif // TEST_H
@@ -0,0 +1,263 @@
+/*
+ * Hecate - Keymap Host Test
+ *
+ * Runs src/keymap.c (built with the example map: Caps Lock as Left Ctrl,
+ * Right GUI holding the function layer, Left Ctrl + Left Alt the media
+ * layer) against a recording ps2_keyboard_send_key(). Keys and the layer
+ * keys are pressed and released in every order, scripted and at random;
+ * every break must match an earlier make of the same output key, and
+ * nothing may be left down once all physical keys are up. The random
+ * run also models which physical keys hold each output: an output is
+ * made only when the first of them goes down and broken only when the
+ * last one is released.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "keymap.h"
+#include "tusb.h"
+#include "test.h"
+
+static u8 out_down[256];        // Makes minus breaks per output key
+static u32 out_events;
+
+// Physical keys holding each output, per the model in test_random()
+static u8 model_refs[256];
+static bool model_on;
+
+// What the keymap hands on to the PS/2 keyboard
+void ps2_keyboard_send_key(u8 hid_key, bool pressed) {
+    out_events++;
+    if (model_on) {
+        CHECK(!pressed || model_refs[hid_key], "make of 0x%02x nothing holds", hid_key);
+        CHECK(pressed || !model_refs[hid_key], "break of 0x%02x while %u keys hold it", hid_key,
+              model_refs[hid_key]);
+    }
+    if (pressed) {
+        CHECK(!out_down[hid_key], "second make of 0x%02x", hid_key);
+        out_down[hid_key]++;
+    } else {
+        CHECK(out_down[hid_key], "break of 0x%02x without a make", hid_key);
+        if (out_down[hid_key]) out_down[hid_key]--;
+    }
+}
+
+static u8 last_out(void) {
+    for (u16 k = 0; k < 256; k++) {
+        if (out_down[k]) return k;
+    }
+    return 0;
+}
+
+static void check_all_up(const char* what) {
+    for (u16 k = 0; k < 256; k++) {
+        CHECK(!out_down[k], "%s: 0x%02x left down", what, k);
+        out_down[k] = 0;
+    }
+}
+
+// Key pressed before the layer, released inside it: its own break
+static void test_key_then_layer(void) {
+    keymap_key(HID_KEY_1, true);
+    CHECK(out_down[HID_KEY_1], "1 not made");
+    keymap_key(HID_KEY_GUI_RIGHT, true);
+    keymap_key(HID_KEY_1, false);
+    CHECK(!out_down[HID_KEY_F1], "F1 broken instead of 1");
+    keymap_key(HID_KEY_GUI_RIGHT, false);
+    check_all_up("key then layer");
+}
+
+// Key pressed inside the layer, layer released first: F1's break
+static void test_layer_then_key(void) {
+    keymap_key(HID_KEY_GUI_RIGHT, true);
+    keymap_key(HID_KEY_1, true);
+    CHECK(out_down[HID_KEY_F1], "1 in the layer is not F1");
+    keymap_key(HID_KEY_GUI_RIGHT, false);
+    keymap_key(HID_KEY_1, false);
+    check_all_up("layer then key");
+
+    // And the layer is gone again
+    keymap_key(HID_KEY_1, true);
+    CHECK(out_down[HID_KEY_1], "layer still active");
+    keymap_key(HID_KEY_1, false);
+    check_all_up("layer released");
+}
+
+// The layer key itself never reaches the host
+static void test_layer_key_silent(void) {
+    u32 events = out_events;
+    keymap_key(HID_KEY_GUI_RIGHT, true);
+    keymap_key(HID_KEY_GUI_RIGHT, false);
+    CHECK(out_events == events, "layer key sent to the host");
+}
+
+// Remapped modifier: Caps Lock makes and breaks Left Ctrl
+static void test_remap(void) {
+    keymap_key(HID_KEY_CAPS_LOCK, true);
+    CHECK(last_out() == HID_KEY_CONTROL_LEFT, "Caps Lock not Ctrl");
+    keymap_key(HID_KEY_GUI_RIGHT, true);
+    keymap_key(HID_KEY_CAPS_LOCK, false);
+    keymap_key(HID_KEY_GUI_RIGHT, false);
+    check_all_up("remap");
+}
+
+// Caps Lock (as Left Ctrl) and Left Ctrl held together: one make, and
+// the break only when both are up, in either order
+static void test_shared_output(void) {
+    u32 events = out_events;
+    keymap_key(HID_KEY_CAPS_LOCK, true);
+    keymap_key(HID_KEY_CONTROL_LEFT, true);
+    CHECK(out_events == events + 1, "Left Ctrl made twice");
+    keymap_key(HID_KEY_CAPS_LOCK, false);
+    CHECK(out_down[HID_KEY_CONTROL_LEFT], "Left Ctrl broken while still held");
+    keymap_key(HID_KEY_CONTROL_LEFT, false);
+    check_all_up("shared output");
+
+    // 1 as F1 in the function layer, and the F1 key itself
+    keymap_key(HID_KEY_F1, true);
+    keymap_key(HID_KEY_GUI_RIGHT, true);
+    keymap_key(HID_KEY_1, true);
+    keymap_key(HID_KEY_F1, false);
+    CHECK(out_down[HID_KEY_F1], "F1 broken while 1 still holds it");
+    keymap_key(HID_KEY_1, false);
+    keymap_key(HID_KEY_GUI_RIGHT, false);
+    check_all_up("shared F1");
+}
+
+// Left Ctrl + Left Alt selects the media layer; the modifiers still
+// reach the host, one of them alone does not select it
+static void test_mod_layer(void) {
+    keymap_key(HID_KEY_CONTROL_LEFT, true);
+    keymap_key(HID_KEY_F1, true);
+    CHECK(out_down[HID_KEY_F1], "Ctrl + F1 is not F1");
+    keymap_key(HID_KEY_F1, false);
+
+    keymap_key(HID_KEY_ALT_LEFT, true);
+    CHECK(out_down[HID_KEY_CONTROL_LEFT] && out_down[HID_KEY_ALT_LEFT], "modifiers swallowed");
+    keymap_key(HID_KEY_F1, true);
+    CHECK(out_down[HID_KEY_MUTE], "Ctrl + Alt + F1 is not Mute");
+
+    // Layer drops with Alt; F1 still releases as Mute
+    keymap_key(HID_KEY_ALT_LEFT, false);
+    keymap_key(HID_KEY_F2, true);
+    CHECK(out_down[HID_KEY_F2], "media layer still active");
+    keymap_key(HID_KEY_F2, false);
+    keymap_key(HID_KEY_F1, false);
+    CHECK(!out_down[HID_KEY_MUTE], "Mute left down");
+
+    // Caps Lock sends Left Ctrl but is not the physical modifier
+    keymap_key(HID_KEY_CONTROL_LEFT, false);
+    keymap_key(HID_KEY_CAPS_LOCK, true);
+    keymap_key(HID_KEY_ALT_LEFT, true);
+    keymap_key(HID_KEY_F1, true);
+    CHECK(out_down[HID_KEY_F1], "Caps Lock + Alt selected the media layer");
+    keymap_key(HID_KEY_F1, false);
+    keymap_key(HID_KEY_ALT_LEFT, false);
+    keymap_key(HID_KEY_CAPS_LOCK, false);
+    check_all_up("mod layer");
+}
+
+// A release nothing was pressed as (keys held over from before boot)
+// passes through once and does not unbalance later presses
+static void test_stray_release(void) {
+    out_down[HID_KEY_A] = 1;
+    keymap_key(HID_KEY_A, false);
+    keymap_key(HID_KEY_A, true);
+    keymap_key(HID_KEY_A, false);
+    check_all_up("stray release");
+}
+
+// The example map for the keys test_random() presses: what a press
+// produces with the function and media layers as given
+static u8 model_map(u8 key, bool fn, bool media) {
+    if (media) {
+        switch (key) {
+            case HID_KEY_F1: return HID_KEY_MUTE;
+            case HID_KEY_F2: return HID_KEY_VOLUME_DOWN;
+        }
+    }
+    if (fn) {
+        switch (key) {
+            case HID_KEY_1: return HID_KEY_F1;
+            case HID_KEY_2: return HID_KEY_F2;
+            case HID_KEY_0: return HID_KEY_F10;
+            case HID_KEY_MINUS: return HID_KEY_F11;
+            case HID_KEY_I: return HID_KEY_ARROW_UP;
+            case HID_KEY_J: return HID_KEY_ARROW_LEFT;
+            case HID_KEY_BACKSPACE: return HID_KEY_DELETE;
+        }
+    }
+    switch (key) {
+        case HID_KEY_CAPS_LOCK: return HID_KEY_CONTROL_LEFT;
+        case HID_KEY_GUI_RIGHT: return KM_LAYER(1);
+    }
+    return key;
+}
+
+// Random presses and releases in any order over mapped, layer and plain
+// keys, including the keys the remaps produce; every physical release
+// must release what its press produced, and no output may be broken
+// while another physical key still holds it
+static void test_random(void) {
+    static const u8 keys[] = {
+        HID_KEY_GUI_RIGHT, HID_KEY_1, HID_KEY_2, HID_KEY_0, HID_KEY_MINUS,
+        HID_KEY_I, HID_KEY_J, HID_KEY_A, HID_KEY_BACKSPACE, HID_KEY_CAPS_LOCK,
+        HID_KEY_SHIFT_LEFT, HID_KEY_CONTROL_RIGHT, HID_KEY_CONTROL_LEFT,
+        HID_KEY_ALT_LEFT, HID_KEY_F1, HID_KEY_F2, HID_KEY_ARROW_UP,
+    };
+    bool held[sizeof(keys)] = { 0 };
+    u8 pressed_as[sizeof(keys)] = { 0 };
+    u32 lcg = 12345;
+
+    model_on = true;
+    for (u32 step = 0; step < 200000; step++) {
+        lcg = lcg * 1664525 + 1013904223;
+        u8 i = (lcg >> 16) % sizeof(keys);
+        held[i] = !held[i];
+
+        // Layer state from the physical keys held before this one
+        bool fn = false, ctrl = false, alt = false;
+        for (u8 j = 0; j < sizeof(keys); j++) {
+            if (j == i || !held[j]) continue;
+            fn |= keys[j] == HID_KEY_GUI_RIGHT;
+            ctrl |= keys[j] == HID_KEY_CONTROL_LEFT;
+            alt |= keys[j] == HID_KEY_ALT_LEFT;
+        }
+
+        if (held[i]) {
+            pressed_as[i] = model_map(keys[i], fn, ctrl && alt);
+            if (!KM_IS_LAYER(pressed_as[i])) model_refs[pressed_as[i]]++;
+        } else if (!KM_IS_LAYER(pressed_as[i])) {
+            model_refs[pressed_as[i]]--;
+        }
+        keymap_key(keys[i], held[i]);
+
+        for (u16 k = 0; k < 256; k++) {
+            CHECK(!out_down[k] == !model_refs[k], "step %u: 0x%02x %s, %u keys hold it", step, k,
+                  out_down[k] ? "down" : "up", model_refs[k]);
+        }
+    }
+
+    for (u8 i = 0; i < sizeof(keys); i++) {
+        if (!held[i]) continue;
+        if (!KM_IS_LAYER(pressed_as[i])) model_refs[pressed_as[i]]--;
+        keymap_key(keys[i], false);
+    }
+    model_on = false;
+    check_all_up("random");
+}
+
+int main(void) {
+    keymap_init();
+
+    test_key_then_layer();
+    test_layer_then_key();
+    test_layer_key_silent();
+    test_remap();
+    test_shared_output();
+    test_mod_layer();
+    test_stray_release();
+    test_random();
+
+    return test_result("keymap");
+}
@@ -0,0 +1,297 @@
+/*
+ * Hecate - PS/2 PIO Program Host Test
+ *
+ * Runs the pioasm output of src/ps2out.pio in the PIO interpreter, set up
+ * by the program's own ps2out_program_init_ex(), against a model PS/2
+ * host on open-drain CLK and DATA lines. At the slowest and fastest bit
+ * rate ps2out_set_bit_rate() allows, and the default, it checks:
+ *   - device-to-host frames: start bit, data LSB first, odd parity, stop
+ *   - back-to-back bytes take exactly PS2OUT_TX_BYTE_CYCLES
+ *   - a host inhibit mid-frame stalls the SM at ps2out_offset_abort, and
+ *     after the flag is cleared nothing goes out until the frame is
+ *     queued again
+ *   - host-to-device frames: data and parity land in the RX FIFO as
+ *     ps2out_rx() expects them, and the device ACKs the stop bit
+ *   - bit rate within 10-16.7 kHz and CLK low within 30-50 us, both
+ *     directions
+ *
+ * Usage: test_ps2out_pio [clkdiv]  - with a divider, only print the
+ * timing it gives (bit period, CLK low, bytes/s)
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ps2out.h"
+#include "ps2out.pio.h"
+#include "pio_sim.h"
+#include "test.h"
+#include <stdlib.h>
+
+// clk_sys as main.c sets it
+#define CLK_SYS_HZ  120000000
+#define SYS_PER_US  (CLK_SYS_HZ / 1000000)
+
+#define DAT         11
+#define CLK         12
+#define SM          0
+
+static struct pio_sim block;
+static PIO pio = &block;
+static uint offset;
+
+// CLK edges seen by the host, in system cycles, and DATA at each fall
+#define EDGES 64
+static uint64_t fall_at[EDGES];
+static uint64_t rise_at[EDGES];
+static bool fall_data[EDGES];
+static uint falls, rises;
+static bool clk_last;
+
+// Timing measured from the edges, in microseconds
+typedef struct {
+    double bit_us;          // Average fall-to-fall over the frame
+    double low_min_us;
+    double low_max_us;
+    double high_max_us;
+} frame_timing;
+
+static void edges_reset(void) {
+    falls = rises = 0;
+    clk_last = pio_sim_pin(pio, CLK);
+}
+
+static void tick(void) {
+    pio_sim_tick(pio);
+
+    bool clk = pio_sim_pin(pio, CLK);
+    if (clk != clk_last) {
+        if (!clk && falls < EDGES) {
+            fall_data[falls] = pio_sim_pin(pio, DAT);
+            fall_at[falls++] = pio->now;
+        } else if (clk && rises < EDGES) {
+            rise_at[rises++] = pio->now;
+        }
+        clk_last = clk;
+    }
+}
+
+static void run_us(uint us) {
+    for (uint64_t i = 0; i < (uint64_t)us * SYS_PER_US; i++) tick();
+}
+
+// Run until the SM raises its IRQ flag; false after timeout_us
+static bool run_until_irq(uint timeout_us) {
+    for (uint64_t i = 0; i < (uint64_t)timeout_us * SYS_PER_US; i++) {
+        if (pio->irq >> SM & 1) return true;
+        tick();
+    }
+    return pio->irq >> SM & 1;
+}
+
+// Frame as ps2_frame() in ps2out.c builds it: start, data, odd parity,
+// stop, inverted because the program drives pindirs
+static uint32_t tx_frame(uint8_t byte) {
+    bool parity = 1;
+    for (uint i = 0; i < 8; i++) parity ^= byte >> i & 1;
+    return ((1u << 10) | ((uint32_t)parity << 9) | ((uint32_t)byte << 1)) ^ 0x7ff;
+}
+
+static bool odd_parity(uint8_t byte, bool parity) {
+    uint ones = parity;
+    for (uint i = 0; i < 8; i++) ones += byte >> i & 1;
+    return ones & 1;
+}
+
+static float rate_div(uint32_t hz) {
+    return (float)CLK_SYS_HZ / ((float)hz * PS2OUT_TX_BIT_CYCLES);
+}
+
+static void setup(float div) {
+    pio_sim_reset(pio);
+    offset = pio_add_program(pio, &ps2out_program);
+    ps2out_program_init_ex(pio, SM, offset, DAT, CLK, div);
+    run_us(200);
+    edges_reset();
+}
+
+// Timing over falls first..last (and the low phase after each)
+static frame_timing timing(uint first, uint last) {
+    frame_timing t = { .low_min_us = 1e9 };
+    t.bit_us = (double)(fall_at[last] - fall_at[first]) / (last - first) / SYS_PER_US;
+
+    for (uint i = first; i <= last && i < rises; i++) {
+        double low = (double)(rise_at[i] - fall_at[i]) / SYS_PER_US;
+        if (low < t.low_min_us) t.low_min_us = low;
+        if (low > t.low_max_us) t.low_max_us = low;
+        if (i + 1 < falls) {
+            double high = (double)(fall_at[i + 1] - rise_at[i]) / SYS_PER_US;
+            if (i < last && high > t.high_max_us) t.high_max_us = high;
+        }
+    }
+    return t;
+}
+
+static void check_spec(const char* what, uint32_t hz, frame_timing t) {
+    double khz = 1000.0 / t.bit_us;
+    CHECK(khz >= 10.0 && khz <= 16.7, "%s at %u Hz: bit rate %.2f kHz", what, hz, khz);
+    CHECK(t.low_min_us >= 30.0 && t.low_max_us <= 50.0, "%s at %u Hz: CLK low %.2f-%.2f us",
+          what, hz, t.low_min_us, t.low_max_us);
+}
+
+// Device-to-host byte; returns its timing
+static frame_timing tx_byte(uint8_t byte) {
+    edges_reset();
+    pio_sim_put(pio, SM, tx_frame(byte));
+
+    CHECK(run_until_irq(2000), "byte %02x: no IRQ", byte);
+    CHECK(pio->sm[SM].pc != offset + ps2out_offset_abort, "byte %02x: aborted", byte);
+    pio->irq &= ~(1u << SM);
+    run_us(100);
+
+    CHECK(falls == 11, "byte %02x: %u clocks", byte, falls);
+    if (falls != 11) return (frame_timing){ 0 };
+
+    uint8_t data = 0;
+    for (uint i = 0; i < 8; i++) data |= fall_data[1 + i] << i;
+    CHECK(!fall_data[0], "byte %02x: start bit high", byte);
+    CHECK(data == byte, "byte %02x: host read %02x", byte, data);
+    CHECK(odd_parity(data, fall_data[9]), "byte %02x: parity", byte);
+    CHECK(fall_data[10], "byte %02x: stop bit low", byte);
+
+    return timing(0, 10);
+}
+
+// Back-to-back bytes, refilled the moment the IRQ is raised: the SM
+// cycles between IRQs are the byte cost PS2OUT_TX_BYTE_CYCLES claims
+static double tx_throughput(uint bytes) {
+    uint64_t irq_cycles = 0;
+    uint64_t first_now = 0;
+
+    pio_sim_put(pio, SM, tx_frame(0x55));
+    for (uint i = 0; i < bytes; i++) {
+        CHECK(run_until_irq(2000), "stream byte %u: no IRQ", i);
+        pio->irq &= ~(1u << SM);
+
+        uint64_t cycles = pio->sm[SM].cycles;
+        if (i) {
+            CHECK(cycles - irq_cycles == PS2OUT_TX_BYTE_CYCLES, "byte %u took %llu SM cycles", i,
+                  (unsigned long long)(cycles - irq_cycles));
+        } else {
+            first_now = pio->now;
+        }
+        irq_cycles = cycles;
+        if (i + 1 < bytes) pio_sim_put(pio, SM, tx_frame(0x55));
+    }
+
+    run_us(100);
+    return (double)(bytes - 1) * CLK_SYS_HZ / (double)(pio->now - 100 * SYS_PER_US - first_now);
+}
+
+// Host inhibit in the middle of a frame
+static void tx_abort(void) {
+    edges_reset();
+    pio_sim_put(pio, SM, tx_frame(0xa5));
+    while (falls < 4) tick();
+
+    // Host grabs CLK and holds it for 100us
+    pio->ext_low[CLK] = true;
+    CHECK(run_until_irq(200), "abort: no IRQ");
+    CHECK(pio->sm[SM].pc == offset + ps2out_offset_abort, "abort: SM at %u, not at abort",
+          pio->sm[SM].pc - offset);
+    run_us(100);
+    CHECK(pio->sm[SM].pc == offset + ps2out_offset_abort, "abort: SM left abort on its own");
+
+    // The interrupt handler clears the flag; the line is released with
+    // DATA high, so no host command follows
+    pio->irq &= ~(1u << SM);
+    pio->ext_low[CLK] = false;
+    edges_reset();
+    run_us(2000);
+    CHECK(falls == 0, "abort: %u clocks after the abort, OSR not flushed", falls);
+    CHECK(!pio->sm[SM].rx_n, "abort: a host byte was received");
+
+    // Retransmitted from the start
+    tx_byte(0xa5);
+}
+
+// Host-to-device byte, host side of the protocol: request to send, then
+// a bit on every falling edge the device clocks, stop, and read the ACK
+static frame_timing rx_byte(uint8_t byte, bool* acked) {
+    bool parity = !odd_parity(byte, 0);
+
+    pio->ext_low[CLK] = true;
+    run_us(100);
+    pio->ext_low[DAT] = true;
+    run_us(10);
+    pio->ext_low[CLK] = false;
+    edges_reset();
+
+    uint handled = 0;
+    *acked = false;
+    for (uint64_t i = 0; i < 3000ull * SYS_PER_US && handled < 11; i++) {
+        tick();
+        if (falls == handled) continue;
+        handled = falls;
+
+        if (handled <= 8) {
+            pio->ext_low[DAT] = !(byte >> (handled - 1) & 1);
+        } else if (handled == 9) {
+            pio->ext_low[DAT] = !parity;
+        } else if (handled == 10) {
+            pio->ext_low[DAT] = false;
+        } else {
+            *acked = !fall_data[10];
+        }
+    }
+    run_us(200);
+
+    uint32_t word = 0;
+    CHECK(pio_sim_get(pio, SM, &word), "rx %02x: nothing in the RX FIFO", byte);
+    uint32_t fifo = word >> 23;
+    CHECK((fifo & 0xff) == byte, "rx %02x: FIFO has %02x", byte, fifo & 0xff);
+    CHECK((fifo >> 8) == parity, "rx %02x: parity bit %u", byte, fifo >> 8);
+    CHECK(*acked, "rx %02x: no ACK", byte);
+    CHECK(pio_sim_pin(pio, CLK) && pio_sim_pin(pio, DAT), "rx %02x: lines not released", byte);
+
+    // Falls 1..10 clock the data, parity and stop bits
+    return timing(1, 10);
+}
+
+// Everything at one divider; prints what the chip would do with it
+static void run_div(uint32_t hz, float div, bool spec) {
+    static const uint8_t bytes[] = { 0x00, 0xff, 0xfa, 0xaa, 0x55, 0x01, 0x80 };
+    frame_timing tx = { 0 };
+    frame_timing rx = { 0 };
+    bool acked;
+
+    setup(div);
+    for (uint i = 0; i < sizeof(bytes); i++) tx = tx_byte(bytes[i]);
+    double bytes_s = tx_throughput(16);
+    tx_abort();
+    for (uint i = 0; i < sizeof(bytes); i++) rx = rx_byte(bytes[i], &acked);
+
+    if (spec) {
+        check_spec("TX", hz, tx);
+        check_spec("RX", hz, rx);
+    }
+
+    printf("div %.4f: TX bit %.2f us (CLK low %.2f us, high %.2f us), "
+           "RX bit %.2f us (CLK low %.2f us, high %.2f us), %.0f bytes/s\n",
+           div, tx.bit_us, tx.low_max_us, tx.high_max_us, rx.bit_us, rx.low_max_us,
+           rx.high_max_us, bytes_s);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        run_div(0, strtof(argv[1], NULL), false);
+        return test_result("ps2out_pio");
+    }
+
+    static const uint32_t rates[] = { PS2OUT_BIT_RATE_MIN, PS2OUT_BIT_RATE_DEFAULT,
+                                      PS2OUT_BIT_RATE_MAX };
+    for (uint i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        printf("%u Hz, ", rates[i]);
+        run_div(rates[i], rate_div(rates[i]), true);
+    }
+    return test_result("ps2out_pio");
+}
@@ -0,0 +1,128 @@
+/*
+ * Hecate - Sample Clock Host Test
+ *
+ * Drives src/sample_clock.c the way ps2_mouse.c does, on a fake clock:
+ * an alarm that fires some interrupt latency after each slot, with and
+ * without USB reports at the sample rate to phase lock to. Checks at
+ * every rate a host can set that intervals stay within the latency and
+ * phase step bounds, and that the grid never drifts.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "sample_clock.h"
+#include "test.h"
+
+// Same lead as ps2_mouse.c
+#define LEAD_US      500
+
+// Worst interrupt latency the fake alarm adds
+#define LATENCY_US   20
+
+#define SLOTS        2000
+
+static const uint8_t rates[] = { 10, 20, 40, 60, 80, 100, 200 };
+
+// Deterministic latency in 0..LATENCY_US
+static uint32_t lcg = 1;
+static uint32_t latency(void) {
+    lcg = lcg * 1664525 + 1013904223;
+    return (lcg >> 16) % (LATENCY_US + 1);
+}
+
+// Free-running grid: slots at exact multiples of 1e6 / rate, each
+// interval within a microsecond of the period plus the latency spread
+static void test_grid(uint8_t rate) {
+    uint32_t period = 1000000 / rate;
+    uint64_t start = 1000000;
+    sample_clock sc;
+    uint64_t last = 0;
+
+    sample_clock_start(&sc, start);
+    for (uint32_t n = 0; n < SLOTS; n++) {
+        CHECK(sc.at == start + (uint64_t)n * 1000000 / rate,
+              "rate %u slot %u at %llu", rate, n, (unsigned long long)sc.at);
+
+        uint64_t now = sc.at + latency();
+        if (last) {
+            uint32_t interval = now - last;
+            CHECK(interval + LATENCY_US + 1 >= period && interval <= period + LATENCY_US + 1,
+                  "rate %u interval %u", rate, interval);
+        }
+        last = now;
+        sample_clock_next(&sc, rate, now);
+    }
+
+    // No drift: the grid lands exactly on start + SLOTS seconds / rate
+    CHECK(sc.at == start + (uint64_t)SLOTS * 1000000 / rate,
+          "rate %u drifted to %llu", rate, (unsigned long long)sc.at);
+}
+
+// USB reports at the sample rate: the slot converges to LEAD_US after
+// each report, moving at most SC_PHASE_STEP_US per slot on the way
+static void test_lock(uint8_t rate) {
+    uint32_t period = 1000000 / rate;
+    uint64_t start = 1000000;
+    uint64_t report = start + period / 2;       // Out of phase to begin with
+    sample_clock sc;
+    uint64_t last = 0;
+    uint32_t lead = 0;
+
+    sample_clock_start(&sc, start);
+    for (uint32_t n = 0; n < SLOTS; n++) {
+        // Newest report before the slot fires
+        while (report + period <= sc.at) report += period;
+        uint64_t now = sc.at + latency();
+
+        if (last) {
+            uint32_t interval = now - last;
+            uint32_t bound = SC_PHASE_STEP_US + LATENCY_US + 1;
+            CHECK(interval + bound >= period && interval <= period + bound,
+                  "rate %u locked interval %u", rate, interval);
+        }
+        last = now;
+
+        lead = (uint32_t)(sc.at - report);
+        sample_clock_lock(&sc, rate, (uint32_t)report, period, LEAD_US);
+        CHECK(sc.adj >= -SC_PHASE_STEP_US && sc.adj <= SC_PHASE_STEP_US,
+              "rate %u adj %d", rate, (int)sc.adj);
+        sample_clock_next(&sc, rate, now);
+    }
+
+    // Settled within the rounding of the quarter-error step
+    CHECK(lead + 4 >= LEAD_US && lead <= LEAD_US + 4, "rate %u settled lead %u", rate, lead);
+}
+
+// Reports at another cadence never move the grid
+static void test_no_lock(uint8_t rate) {
+    uint32_t period = 1000000 / rate;
+    sample_clock sc;
+
+    sample_clock_start(&sc, 1000000);
+    sample_clock_lock(&sc, rate, 1000000 - 100, period / 2, LEAD_US);
+    CHECK(sc.adj == 0, "rate %u locked to a faster source", rate);
+    sample_clock_lock(&sc, rate, 1000000 - 100, period * 2, LEAD_US);
+    CHECK(sc.adj == 0, "rate %u locked to a slower source", rate);
+}
+
+// A clock held off for several slots restarts from now, no burst
+static void test_catch_up(uint8_t rate) {
+    uint32_t period = 1000000 / rate;
+    sample_clock sc;
+
+    sample_clock_start(&sc, 1000000);
+    uint64_t now = 1000000 + 5 * (uint64_t)period + 7;
+    sample_clock_next(&sc, rate, now);
+    CHECK(sc.at == now + period, "rate %u caught up to %llu", rate, (unsigned long long)sc.at);
+    CHECK(sc.frac == 0, "rate %u kept a stale remainder", rate);
+}
+
+int main(void) {
+    for (uint8_t i = 0; i < sizeof(rates); i++) {
+        test_grid(rates[i]);
+        test_lock(rates[i]);
+        test_no_lock(rates[i]);
+        test_catch_up(rates[i]);
+    }
+    return test_result("sample_clock");
+}
@@ -0,0 +1,326 @@
+#!/usr/bin/env python3
+#
+# Hecate - PS/2 Scancode Table Generator
+#
+# Generates ps2_scancodes.h: for every HID keyboard usage and every
+# scancode set (1, 2, 3), the complete make, break and repeat byte
+# sequences, so the keyboard driver only looks them up and copies them
+# into the TX ring.
+#
+# Set 2 is the source of truth. Set 1 is derived from it with the 8042
+# translation table (F0 prefix becomes bit 7), the way an AT controller
+# would; Set 3 uses its own single-byte codes with F0 breaks.
+#
+# Usage: gen_scancodes.py <output header>
+#
+# SPDX-License-Identifier: MIT
+#
+
+import sys
+
+# (HID usage, name, Set 2 make, Set 3 code or 0 for none)
+KEYS = [
+    (0x04, "A",               "1c",    0x1c),
+    (0x05, "B",               "32",    0x32),
+    (0x06, "C",               "21",    0x21),
+    (0x07, "D",               "23",    0x23),
+    (0x08, "E",               "24",    0x24),
+    (0x09, "F",               "2b",    0x2b),
+    (0x0a, "G",               "34",    0x34),
+    (0x0b, "H",               "33",    0x33),
+    (0x0c, "I",               "43",    0x43),
+    (0x0d, "J",               "3b",    0x3b),
+    (0x0e, "K",               "42",    0x42),
+    (0x0f, "L",               "4b",    0x4b),
+    (0x10, "M",               "3a",    0x3a),
+    (0x11, "N",               "31",    0x31),
+    (0x12, "O",               "44",    0x44),
+    (0x13, "P",               "4d",    0x4d),
+    (0x14, "Q",               "15",    0x15),
+    (0x15, "R",               "2d",    0x2d),
+    (0x16, "S",               "1b",    0x1b),
+    (0x17, "T",               "2c",    0x2c),
+    (0x18, "U",               "3c",    0x3c),
+    (0x19, "V",               "2a",    0x2a),
+    (0x1a, "W",               "1d",    0x1d),
+    (0x1b, "X",               "22",    0x22),
+    (0x1c, "Y",               "35",    0x35),
+    (0x1d, "Z",               "1a",    0x1a),
+    (0x1e, "1",               "16",    0x16),
+    (0x1f, "2",               "1e",    0x1e),
+    (0x20, "3",               "26",    0x26),
+    (0x21, "4",               "25",    0x25),
+    (0x22, "5",               "2e",    0x2e),
+    (0x23, "6",               "36",    0x36),
+    (0x24, "7",               "3d",    0x3d),
+    (0x25, "8",               "3e",    0x3e),
+    (0x26, "9",               "46",    0x46),
+    (0x27, "0",               "45",    0x45),
+    (0x28, "ENTER",           "5a",    0x5a),
+    (0x29, "ESCAPE",          "76",    0x08),
+    (0x2a, "BACKSPACE",       "66",    0x66),
+    (0x2b, "TAB",             "0d",    0x0d),
+    (0x2c, "SPACE",           "29",    0x29),
+    (0x2d, "MINUS",           "4e",    0x4e),
+    (0x2e, "EQUAL",           "55",    0x55),
+    (0x2f, "BRACKET_LEFT",    "54",    0x54),
+    (0x30, "BRACKET_RIGHT",   "5b",    0x5b),
+    (0x31, "BACKSLASH",       "5d",    0x5c),
+    (0x32, "EUROPE_1",        "5d",    0x53),
+    (0x33, "SEMICOLON",       "4c",    0x4c),
+    (0x34, "APOSTROPHE",      "52",    0x52),
+    (0x35, "GRAVE",           "0e",    0x0e),
+    (0x36, "COMMA",           "41",    0x41),
+    (0x37, "PERIOD",          "49",    0x49),
+    (0x38, "SLASH",           "4a",    0x4a),
+    (0x39, "CAPS_LOCK",       "58",    0x14),
+    (0x3a, "F1",              "05",    0x07),
+    (0x3b, "F2",              "06",    0x0f),
+    (0x3c, "F3",              "04",    0x17),
+    (0x3d, "F4",              "0c",    0x1f),
+    (0x3e, "F5",              "03",    0x27),
+    (0x3f, "F6",              "0b",    0x2f),
+    (0x40, "F7",              "83",    0x37),
+    (0x41, "F8",              "0a",    0x3f),
+    (0x42, "F9",              "01",    0x47),
+    (0x43, "F10",             "09",    0x4f),
+    (0x44, "F11",             "78",    0x56),
+    (0x45, "F12",             "07",    0x5e),
+    (0x46, "PRINT_SCREEN",    "e0 7c", 0x57),
+    (0x47, "SCROLL_LOCK",     "7e",    0x5f),
+    (0x48, "PAUSE",           None,    0x62),
+    (0x49, "INSERT",          "e0 70", 0x67),
+    (0x4a, "HOME",            "e0 6c", 0x6e),
+    (0x4b, "PAGE_UP",         "e0 7d", 0x6f),
+    (0x4c, "DELETE",          "e0 71", 0x64),
+    (0x4d, "END",             "e0 69", 0x65),
+    (0x4e, "PAGE_DOWN",       "e0 7a", 0x6d),
+    (0x4f, "ARROW_RIGHT",     "e0 74", 0x6a),
+    (0x50, "ARROW_LEFT",      "e0 6b", 0x61),
+    (0x51, "ARROW_DOWN",      "e0 72", 0x60),
+    (0x52, "ARROW_UP",        "e0 75", 0x63),
+    (0x53, "NUM_LOCK",        "77",    0x76),
+    (0x54, "KEYPAD_DIVIDE",   "e0 4a", 0x77),
+    (0x55, "KEYPAD_MULTIPLY", "7c",    0x7e),
+    (0x56, "KEYPAD_SUBTRACT", "7b",    0x84),
+    (0x57, "KEYPAD_ADD",      "79",    0x7c),
+    (0x58, "KEYPAD_ENTER",    "e0 5a", 0x79),
+    (0x59, "KEYPAD_1",        "69",    0x69),
+    (0x5a, "KEYPAD_2",        "72",    0x72),
+    (0x5b, "KEYPAD_3",        "7a",    0x7a),
+    (0x5c, "KEYPAD_4",        "6b",    0x6b),
+    (0x5d, "KEYPAD_5",        "73",    0x73),
+    (0x5e, "KEYPAD_6",        "74",    0x74),
+    (0x5f, "KEYPAD_7",        "6c",    0x6c),
+    (0x60, "KEYPAD_8",        "75",    0x75),
+    (0x61, "KEYPAD_9",        "7d",    0x7d),
+    (0x62, "KEYPAD_0",        "70",    0x70),
+    (0x63, "KEYPAD_DECIMAL",  "71",    0x71),
+    (0x64, "EUROPE_2",        "61",    0x13),
+    (0x65, "APPLICATION",     "e0 2f", 0x8d),
+    (0x66, "POWER",           "e0 37", 0x00),
+    (0x67, "KEYPAD_EQUAL",    "0f",    0x00),
+    (0x68, "F13",             "08",    0x00),
+    (0x69, "F14",             "10",    0x00),
+    (0x6a, "F15",             "18",    0x00),
+    (0x6b, "F16",             "20",    0x00),
+    (0x6c, "F17",             "28",    0x00),
+    (0x6d, "F18",             "30",    0x00),
+    (0x6e, "F19",             "38",    0x00),
+    (0x6f, "F20",             "40",    0x00),
+    (0x70, "F21",             "48",    0x00),
+    (0x71, "F22",             "50",    0x00),
+    (0x72, "F23",             "57",    0x00),
+    (0x73, "F24",             "5f",    0x00),
+    (0x7f, "MUTE",            "e0 23", 0x00),
+    (0x80, "VOLUME_UP",       "e0 32", 0x00),
+    (0x81, "VOLUME_DOWN",     "e0 21", 0x00),
+    (0x85, "KEYPAD_COMMA",    "6d",    0x00),
+    (0x87, "KANJI1",          "51",    0x51),   # Ro, Brazilian /?
+    (0x88, "KANJI2",          "13",    0x87),   # Katakana/Hiragana
+    (0x89, "KANJI3",          "6a",    0x5d),   # Yen
+    (0x8a, "KANJI4",          "64",    0x86),   # Henkan
+    (0x8b, "KANJI5",          "67",    0x85),   # Muhenkan
+    (0x90, "LANG1",           None,    0x00),   # Hangul/English
+    (0x91, "LANG2",           None,    0x00),   # Hanja
+    (0xe0, "CONTROL_LEFT",    "14",    0x11),
+    (0xe1, "SHIFT_LEFT",      "12",    0x12),
+    (0xe2, "ALT_LEFT",        "11",    0x19),
+    (0xe3, "GUI_LEFT",        "e0 1f", 0x8b),
+    (0xe4, "CONTROL_RIGHT",   "e0 14", 0x58),
+    (0xe5, "SHIFT_RIGHT",     "59",    0x59),
+    (0xe6, "ALT_RIGHT",       "e0 11", 0x39),
+    (0xe7, "GUI_RIGHT",       "e0 27", 0x8c),
+]
+
+# Pseudo usage after the modifiers: Pause pressed with Ctrl held (Break)
+CTRL_PAUSE = 0xe8
+KEY_COUNT = CTRL_PAUSE + 1
+
+# Set 2 sequences that are not a plain make with an F0 break:
+# usage -> (make, break, repeat). These keys neither break nor repeat.
+SET2_SPECIAL = {
+    0x48:       ("e1 14 77 e1 f0 14 f0 77", "", ""),
+    CTRL_PAUSE: ("e0 7e e0 f0 7e", "", ""),
+    0x90:       ("f2", "", ""),
+    0x91:       ("f1", "", ""),
+}
+
+# Set 2 to Set 1 translation of the 8042 controller
+SET1_XLAT = [
+    0xff, 0x43, 0x41, 0x3f, 0x3d, 0x3b, 0x3c, 0x58, 0x64, 0x44, 0x42, 0x40, 0x3e, 0x0f, 0x29, 0x59,
+    0x65, 0x38, 0x2a, 0x70, 0x1d, 0x10, 0x02, 0x5a, 0x66, 0x71, 0x2c, 0x1f, 0x1e, 0x11, 0x03, 0x5b,
+    0x67, 0x2e, 0x2d, 0x20, 0x12, 0x05, 0x04, 0x5c, 0x68, 0x39, 0x2f, 0x21, 0x14, 0x13, 0x06, 0x5d,
+    0x69, 0x31, 0x30, 0x23, 0x22, 0x15, 0x07, 0x5e, 0x6a, 0x72, 0x32, 0x24, 0x16, 0x08, 0x09, 0x5f,
+    0x6b, 0x33, 0x25, 0x17, 0x18, 0x0b, 0x0a, 0x60, 0x6c, 0x34, 0x35, 0x26, 0x27, 0x19, 0x0c, 0x61,
+    0x6d, 0x73, 0x28, 0x74, 0x1a, 0x0d, 0x62, 0x6e, 0x3a, 0x36, 0x1c, 0x1b, 0x75, 0x2b, 0x63, 0x76,
+    0x55, 0x56, 0x77, 0x78, 0x79, 0x7a, 0x0e, 0x7b, 0x7c, 0x4f, 0x7d, 0x4b, 0x47, 0x7e, 0x7f, 0x6f,
+    0x52, 0x53, 0x50, 0x4c, 0x4d, 0x48, 0x01, 0x45, 0x57, 0x4e, 0x51, 0x4a, 0x37, 0x49, 0x46, 0x54,
+    0x80, 0x81, 0x82, 0x41,
+]
+
+MAX_LEN = 8     # Longest sequence (Pause); lengths are stored in 4 bits
+
+
+def parse(seq):
+    return [int(b, 16) for b in seq.split()]
+
+
+def set2_break(make):
+    return make[:-1] + [0xf0, make[-1]]
+
+
+def to_set1(seq):
+    out = []
+    brk = False
+    for code in seq:
+        if code == 0xf0:
+            brk = True
+            continue
+        if code not in (0xe0, 0xe1):
+            if code < len(SET1_XLAT):
+                code = SET1_XLAT[code]
+            if brk:
+                code |= 0x80
+            brk = False
+        out.append(code)
+    return out
+
+
+def build():
+    # seqs[set][kind][usage] = list of bytes (kind: make, break, repeat)
+    seqs = {s: [[[] for _ in range(KEY_COUNT)] for _ in range(3)] for s in (1, 2, 3)}
+    set3 = [0] * KEY_COUNT
+
+    for usage, name, make, code3 in KEYS:
+        set3[usage] = code3
+        if usage in SET2_SPECIAL:
+            m, b, r = (parse(x) for x in SET2_SPECIAL[usage])
+        else:
+            m = parse(make)
+            b, r = set2_break(m), m
+        for kind, seq in enumerate((m, b, r)):
+            seqs[2][kind][usage] = seq
+            seqs[1][kind][usage] = to_set1(seq)
+        if code3:
+            seqs[3][0][usage] = [code3]
+            seqs[3][1][usage] = [0xf0, code3]
+            seqs[3][2][usage] = [code3]
+
+    # Set 2/1 Break sequence; Set 3 has no Break key, Ctrl+Pause is Pause
+    m, b, r = (parse(x) for x in SET2_SPECIAL[CTRL_PAUSE])
+    for kind, seq in enumerate((m, b, r)):
+        seqs[2][kind][CTRL_PAUSE] = seq
+        seqs[1][kind][CTRL_PAUSE] = to_set1(seq)
+        seqs[3][kind][CTRL_PAUSE] = seqs[3][kind][0x48]
+    set3[CTRL_PAUSE] = set3[0x48]
+
+    return seqs, set3
+
+
+def emit(path):
+    seqs, set3 = build()
+
+    # Byte pool, identical sequences shared
+    pool = []
+    offsets = {}
+    index = {}
+    for s in (1, 2, 3):
+        for kind in range(3):
+            for usage in range(KEY_COUNT):
+                seq = tuple(seqs[s][kind][usage])
+                assert len(seq) <= MAX_LEN
+                if seq and seq not in offsets:
+                    offsets[seq] = len(pool)
+                    pool.extend(seq)
+                index[s, kind, usage] = (offsets[seq] << 4 | len(seq)) if seq else 0
+    assert len(pool) < 4096
+
+    names = {usage: name for usage, name, _, _ in KEYS}
+    names[CTRL_PAUSE] = "CTRL+PAUSE"
+
+    lines = [
+        "// Generated by tools/gen_scancodes.py - do not edit",
+        "",
+        "#ifndef PS2_SCANCODES_H",
+        "#define PS2_SCANCODES_H",
+        "",
+        '#include "ps2out.h"',
+        "",
+        "// Table index per HID usage; modifiers at 0xE0-0xE7",
+        "#define KB_SEQ_CTRL_PAUSE 0x%02x     // Pause with Ctrl held (Break)" % CTRL_PAUSE,
+        "#define KB_SEQ_KEYS       0x%02x" % KEY_COUNT,
+        "",
+        "// Sequence kinds",
+        "#define KB_SEQ_MAKE       0",
+        "#define KB_SEQ_BREAK      1",
+        "#define KB_SEQ_REPEAT     2",
+        "",
+        "// Longest sequence",
+        "#define KB_SEQ_MAX        %d" % MAX_LEN,
+        "",
+        "static const u8 kb_seq_pool[%d] = {" % len(pool),
+    ]
+    for i in range(0, len(pool), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in pool[i:i + 16]) + ",")
+    lines += [
+        "};",
+        "",
+        "// [set - 1][kind][usage]: pool offset << 4 | length, 0 = nothing sent",
+        "static const u16 kb_seq[3][3][KB_SEQ_KEYS] = {",
+    ]
+    for s in (1, 2, 3):
+        lines.append("    { // Set %d" % s)
+        for kind, kname in enumerate(("make", "break", "repeat")):
+            lines.append("        { // %s" % kname)
+            for usage in range(KEY_COUNT):
+                v = index[s, kind, usage]
+                if v:
+                    seq = " ".join("%02X" % b for b in seqs[s][kind][usage])
+                    lines.append("            [0x%02x] = 0x%04x, // %s: %s" % (usage, v, names[usage], seq))
+            lines.append("        },")
+        lines.append("    },")
+    lines += [
+        "};",
+        "",
+        "// Set 3 code per usage, for the per-key type attributes (0 = none)",
+        "static const u8 kb_set3_codes[KB_SEQ_KEYS] = {",
+    ]
+    for usage in range(KEY_COUNT):
+        if set3[usage]:
+            lines.append("    [0x%02x] = 0x%02x, // %s" % (usage, set3[usage], names[usage]))
+    lines += [
+        "};",
+        "",
+        "#endif // PS2_SCANCODES_H",
+        "",
+    ]
+
+    with open(path, "w") as f:
+        f.write("\n".join(lines))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit("usage: %s <output header>" % sys.argv[0])
+    emit(sys.argv[1])
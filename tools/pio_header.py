@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""
+Hecate - PIO header generator for the host tests
+
+Minimal stand-in for the SDK's pioasm, used by tests/CMakeLists.txt when
+pioasm is not installed. Assembles the subset of PIO assembly the
+firmware's .pio files use and writes a header in pioasm's c-sdk layout
+(instruction array, wrap, public labels and defines, program struct,
+default config and the % c-sdk block), so the tests include the same
+names either way.
+
+Usage: pio_header.py input.pio output.h
+
+SPDX-License-Identifier: MIT
+"""
+
+import re
+import sys
+
+JMP_COND = {"": 0, "!x": 1, "x--": 2, "!y": 3, "y--": 4, "x!=y": 5, "pin": 6, "!osre": 7}
+IN_SRC = {"pins": 0, "x": 1, "y": 2, "null": 3, "isr": 6, "osr": 7}
+OUT_DST = {"pins": 0, "x": 1, "y": 2, "null": 3, "pindirs": 4, "pc": 5, "isr": 6, "exec": 7}
+MOV_DST = {"pins": 0, "x": 1, "y": 2, "exec": 4, "pc": 5, "isr": 6, "osr": 7}
+MOV_SRC = {"pins": 0, "x": 1, "y": 2, "null": 3, "status": 5, "isr": 6, "osr": 7}
+SET_DST = {"pins": 0, "x": 1, "y": 2, "pindirs": 4}
+WAIT_SRC = {"gpio": 0, "pin": 1, "irq": 2}
+
+
+def fail(line_no, msg):
+    sys.exit(f"pio_header.py: line {line_no}: {msg}")
+
+
+def value(text, defines, line_no):
+    text = text.strip()
+    if text in defines:
+        return defines[text]
+    try:
+        return int(text, 0)
+    except ValueError:
+        fail(line_no, f"bad value '{text}'")
+
+
+class Program:
+    def __init__(self, name):
+        self.name = name
+        self.lines = []             # (line_no, text) of instructions
+        self.labels = {}
+        self.public_labels = []
+        self.side_bits = 0
+        self.side_opt = False
+        self.side_pindirs = False
+        self.wrap_target = None
+        self.wrap = None
+        self.c_sdk = []
+
+
+def parse(path):
+    defines = {}
+    public_defines = []
+    programs = []
+    prog = None
+    in_block = False
+
+    with open(path) as f:
+        for line_no, raw in enumerate(f, 1):
+            if in_block:
+                if raw.startswith("%}"):
+                    in_block = False
+                elif prog:
+                    prog.c_sdk.append(raw.rstrip("\n"))
+                continue
+            if raw.startswith("% c-sdk {"):
+                in_block = True
+                continue
+
+            line = raw.split(";", 1)[0].strip()
+            if not line:
+                continue
+
+            if line.startswith("."):
+                words = line.split()
+                if words[0] == ".program":
+                    prog = Program(words[1])
+                    programs.append(prog)
+                elif words[0] == ".define":
+                    public = words[1] == "public"
+                    name, val = words[2:4] if public else words[1:3]
+                    defines[name] = value(val, defines, line_no)
+                    if public:
+                        public_defines.append(name)
+                elif words[0] == ".side_set":
+                    prog.side_bits = int(words[1])
+                    prog.side_opt = "opt" in words
+                    prog.side_pindirs = "pindirs" in words
+                elif words[0] == ".wrap_target":
+                    prog.wrap_target = len(prog.lines)
+                elif words[0] == ".wrap":
+                    prog.wrap = len(prog.lines) - 1
+                else:
+                    fail(line_no, f"unsupported directive {words[0]}")
+                continue
+
+            m = re.match(r"^(public\s+)?(\w+):\s*(.*)$", line)
+            if m:
+                prog.labels[m.group(2)] = len(prog.lines)
+                if m.group(1):
+                    prog.public_labels.append(m.group(2))
+                line = m.group(3).strip()
+                if not line:
+                    continue
+            prog.lines.append((line_no, line))
+
+    return defines, public_defines, programs
+
+
+def assemble(prog, defines, line_no, text):
+    delay = 0
+    m = re.search(r"\[([^\]]+)\]\s*$", text)
+    if m:
+        delay = value(m.group(1), defines, line_no)
+        text = text[:m.start()].strip()
+
+    side = None
+    m = re.search(r"\bside\s+(\S+)\s*$", text)
+    if m:
+        side = value(m.group(1), defines, line_no)
+        text = text[:m.start()].strip()
+
+    op, _, args = text.partition(" ")
+    args = [a.strip() for a in args.split(",")] if args.strip() else []
+
+    if op == "jmp":
+        cond = args[0] if len(args) == 2 else ""
+        target = args[-1]
+        addr = prog.labels[target] if target in prog.labels else value(target, defines, line_no)
+        word = 0x0000 | JMP_COND[cond] << 5 | addr
+    elif op == "wait":
+        words = " ".join(args).split()
+        word = 0x2000 | value(words[0], defines, line_no) << 7 | WAIT_SRC[words[1]] << 5
+        word |= value(words[2], defines, line_no)
+        if len(words) > 3 and words[3] == "rel":
+            word |= 0x10
+    elif op == "in":
+        word = 0x4000 | IN_SRC[args[0]] << 5 | value(args[1], defines, line_no) & 0x1f
+    elif op == "out":
+        word = 0x6000 | OUT_DST[args[0]] << 5 | value(args[1], defines, line_no) & 0x1f
+    elif op == "mov":
+        src = args[1]
+        inv = 0
+        if src.startswith("~") or src.startswith("!"):
+            inv, src = 1, src[1:].strip()
+        elif src.startswith("::"):
+            inv, src = 2, src[2:].strip()
+        word = 0xa000 | MOV_DST[args[0]] << 5 | inv << 3 | MOV_SRC[src]
+    elif op == "nop":
+        word = 0xa042
+    elif op == "irq":
+        words = " ".join(args).split()
+        mode = words[0] if words[0] in ("set", "nowait", "wait", "clear") else "set"
+        rest = words[1:] if mode == words[0] else words
+        index = value(rest[0], defines, line_no)
+        if len(rest) > 1 and rest[1] == "rel":
+            index |= 0x10
+        word = 0xc000 | (mode == "clear") << 6 | (mode == "wait") << 5 | index
+    elif op == "set":
+        word = 0xe000 | SET_DST[args[0]] << 5 | value(args[1], defines, line_no)
+    else:
+        fail(line_no, f"unsupported instruction '{op}'")
+
+    # Delay/side-set field: side-set bits (with enable) at the top
+    side_bits = prog.side_bits + prog.side_opt
+    if delay >= 1 << (5 - side_bits):
+        fail(line_no, f"delay {delay} too long")
+    field = delay
+    if side is not None:
+        if prog.side_opt:
+            side |= 1 << prog.side_bits
+        field |= side << (5 - side_bits)
+    return word | field << 8
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: pio_header.py input.pio output.h")
+
+    defines, public_defines, programs = parse(sys.argv[1])
+    out = ["// -------------------------------------------------- //",
+           "// This file is autogenerated by tools/pio_header.py //",
+           "//        Do not edit!                               //",
+           "// -------------------------------------------------- //",
+           "",
+           "#pragma once",
+           "",
+           "#if !PICO_NO_HARDWARE",
+           '#include "hardware/pio.h"',
+           "#endif",
+           ""]
+    for name in public_defines:
+        out.append(f"#define {name} {defines[name]}")
+    out.append("")
+
+    for prog in programs:
+        n = prog.name
+        words = [assemble(prog, defines, ln, text) for ln, text in prog.lines]
+        wrap_target = prog.wrap_target or 0
+        wrap = len(words) - 1 if prog.wrap is None else prog.wrap
+
+        out += [f"// {'-' * len(n)} //", f"// {n} //", f"// {'-' * len(n)} //", "",
+                f"#define {n}_wrap_target {wrap_target}", f"#define {n}_wrap {wrap}",
+                f"#define {n}_pio_version 0", ""]
+        for label in prog.public_labels:
+            out.append(f"#define {n}_offset_{label} {prog.labels[label]}u")
+        out += ["", f"static const uint16_t {n}_program_instructions[] = {{"]
+        for i, w in enumerate(words):
+            marker = "    //     .wrap_target" if i == wrap_target else None
+            if marker:
+                out.append(marker)
+            out.append(f"    0x{w:04x}, // {i:2d}: {prog.lines[i][1]}")
+            if i == wrap:
+                out.append("    //     .wrap")
+        out += ["};", "", "#if !PICO_NO_HARDWARE",
+                f"static const struct pio_program {n}_program = {{",
+                f"    .instructions = {n}_program_instructions,",
+                f"    .length = {len(words)},",
+                "    .origin = -1,",
+                f"    .pio_version = {n}_pio_version,",
+                "};", "",
+                f"static inline pio_sm_config {n}_program_get_default_config(uint offset) {{",
+                "    pio_sm_config c = pio_get_default_sm_config();",
+                f"    sm_config_set_wrap(&c, offset + {n}_wrap_target, offset + {n}_wrap);"]
+        if prog.side_bits:
+            side_bits = prog.side_bits + prog.side_opt
+            opt = "true" if prog.side_opt else "false"
+            pindirs = "true" if prog.side_pindirs else "false"
+            out.append(f"    sm_config_set_sideset(&c, {side_bits}, {opt}, {pindirs});")
+        out += ["    return c;", "}", ""]
+        out += prog.c_sdk
+        out += ["", "#endif", ""]
+
+    with open(sys.argv[2], "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()